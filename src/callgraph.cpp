@@ -0,0 +1,133 @@
+#include "callgraph.hpp"
+#include "parser.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::shared_ptr;
+using std::size_t;
+using std::vector;
+
+CallGraph::CallGraph(const Program& program)
+    : callees(program.functions.size())
+    , native_callees(program.functions.size())
+    , component(program.functions.size())
+    , components {}
+    , self_calls(program.functions.size(), false)
+{
+    for (size_t i = 0; i < program.functions.size(); ++i) {
+        walk_stmt(program.functions[i]->comp_stmt,
+            [&](const shared_ptr<Expr>& expr) {
+                auto call { dynamic_pointer_cast<FunCall>(expr) };
+                if (call == nullptr)
+                    return;
+
+                if (call->slot.kind == Slot::Kind::NATIVE) {
+                    auto& natives { native_callees[i] };
+                    if (std::find(natives.begin(), natives.end(),
+                            call->slot.index)
+                        == natives.end())
+                        natives.push_back(call->slot.index);
+                    return;
+                }
+                if (call->slot.kind != Slot::Kind::FUNCTION)
+                    return;
+
+                auto& edges { callees[i] };
+                if (std::find(edges.begin(), edges.end(), call->slot.index)
+                    == edges.end())
+                    edges.push_back(call->slot.index);
+                if (call->slot.index == i)
+                    self_calls[i] = true;
+            });
+    }
+
+    connect();
+}
+
+// Tarjan's algorithm, which emits components in reverse topological order
+void CallGraph::connect()
+{
+    const size_t unvisited { static_cast<size_t>(-1) };
+    vector<size_t> order(callees.size(), unvisited);
+    vector<size_t> low(callees.size(), 0);
+    vector<bool> on_stack(callees.size(), false);
+    vector<size_t> stack {};
+    size_t next { 0 };
+
+    auto visit = [&](auto& visit, size_t fun) -> void {
+        order[fun] = low[fun] = next++;
+        stack.push_back(fun);
+        on_stack[fun] = true;
+
+        for (size_t callee : callees[fun]) {
+            if (order[callee] == unvisited) {
+                visit(visit, callee);
+                low[fun] = std::min(low[fun], low[callee]);
+            } else if (on_stack[callee])
+                low[fun] = std::min(low[fun], order[callee]);
+        }
+
+        if (low[fun] != order[fun])
+            return;
+
+        vector<size_t> members {};
+        size_t member;
+        do {
+            member = stack.back();
+            stack.pop_back();
+            on_stack[member] = false;
+            component[member] = components.size();
+            members.push_back(member);
+        } while (member != fun);
+        components.push_back(std::move(members));
+    };
+
+    for (size_t fun = 0; fun < callees.size(); ++fun)
+        if (order[fun] == unvisited)
+            visit(visit, fun);
+}
+
+const vector<size_t>& CallGraph::calls(size_t fun) const
+{
+    return callees.at(fun);
+}
+
+bool CallGraph::recursive(size_t fun) const
+{
+    return self_calls.at(fun) || components[component.at(fun)].size() > 1;
+}
+
+const vector<vector<size_t>>& CallGraph::bottom_up() const
+{
+    return components;
+}
+
+const vector<size_t>& CallGraph::native_calls(size_t fun) const
+{
+    return native_callees.at(fun);
+}
+
+vector<bool> CallGraph::reachable(size_t entry) const
+{
+    vector<bool> seen(callees.size(), false);
+    vector<size_t> work { entry };
+    seen.at(entry) = true;
+
+    while (!work.empty()) {
+        size_t fun { work.back() };
+        work.pop_back();
+        for (size_t callee : callees[fun])
+            if (!seen[callee]) {
+                seen[callee] = true;
+                work.push_back(callee);
+            }
+    }
+
+    return seen;
+}
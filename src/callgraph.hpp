@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "parser.hpp"
+
+// Direct calls between the functions of a resolved Program, indexed like
+// Program::functions. Calls to extern functions are kept apart, indexed
+// like Program::natives.
+class CallGraph {
+private:
+    std::vector<std::vector<std::size_t>> callees;
+    std::vector<std::vector<std::size_t>> native_callees;
+    std::vector<std::size_t> component; // strongly connected component
+    std::vector<std::vector<std::size_t>> components; // callees first
+    std::vector<bool> self_calls;
+
+    void connect();
+
+public:
+    CallGraph(const Program& program);
+
+    const std::vector<std::size_t>& calls(std::size_t fun) const;
+    const std::vector<std::size_t>& native_calls(std::size_t fun) const;
+    // Part of a cycle, including calling itself
+    bool recursive(std::size_t fun) const;
+    // Components in bottom-up order: every callee outside a component comes
+    // in an earlier one
+    const std::vector<std::vector<std::size_t>>& bottom_up() const;
+    // Functions entry can end up calling, entry included
+    std::vector<bool> reachable(std::size_t entry) const;
+};
@@ -0,0 +1,73 @@
+#include "diagnostics.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::size_t;
+using std::string;
+
+Diagnostics::Diagnostics(string path, string source)
+    : path { std::move(path) }
+    , source { std::move(source) }
+    , entries {}
+    , line_offsets {}
+{
+}
+
+void Diagnostics::error(size_t pos, string msg)
+{
+    entries.push_back({ pos, std::move(msg) });
+}
+
+void Diagnostics::error(const CompileError& e) { error(e.pos, e.what()); }
+
+bool Diagnostics::has_errors() const { return !entries.empty(); }
+
+size_t Diagnostics::count() const { return entries.size(); }
+
+void Diagnostics::index_lines() const
+{
+    line_offsets.push_back(0);
+    for (size_t i = 0; i < source.length(); ++i)
+        if (source[i] == '\n')
+            line_offsets.push_back(i + 1);
+}
+
+pair<size_t, size_t> Diagnostics::location(size_t pos) const
+{
+    if (line_offsets.empty())
+        index_lines();
+
+    auto line { std::upper_bound(
+                    line_offsets.begin(), line_offsets.end(), pos)
+        - 1 };
+    return { line - line_offsets.begin() + 1, pos - *line + 1 };
+}
+
+void Diagnostics::print(std::ostream& out) const
+{
+    for (const auto& entry : entries) {
+        auto [line, col] = location(entry.pos);
+        out << path << ':' << line << ':' << col << ": ERROR: " << entry.msg
+            << '\n';
+
+        size_t begin { line_offsets[line - 1] };
+        size_t end { source.find('\n', begin) };
+        if (end == string::npos)
+            end = source.length();
+
+        // Keep tabs so the caret lines up with the echoed source line
+        string caret { source.substr(begin, col - 1) };
+        for (auto& c : caret)
+            if (c != '\t')
+                c = ' ';
+
+        out << "    " << source.substr(begin, end - begin) << '\n'
+            << "    " << caret << "^\n";
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Error raised while parsing, carries the byte offset of the offending token
+struct CompileError : std::runtime_error {
+    std::size_t pos;
+
+    CompileError(std::size_t pos, const std::string& msg)
+        : std::runtime_error { msg }
+        , pos { pos }
+    {
+    }
+};
+
+// Collects errors for one source buffer. Line/column are only computed when
+// the diagnostics are printed, from a line index built on first use.
+class Diagnostics {
+private:
+    struct Entry {
+        std::size_t pos;
+        std::string msg;
+    };
+
+    std::string path;
+    std::string source;
+    std::vector<Entry> entries;
+    mutable std::vector<std::size_t> line_offsets; // start of every line
+
+    void index_lines() const;
+
+public:
+    Diagnostics(std::string path, std::string source);
+
+    void error(std::size_t pos, std::string msg);
+    void error(const CompileError& e);
+    bool has_errors() const;
+    std::size_t count() const;
+
+    // 1-based { line, column } of a byte offset
+    std::pair<std::size_t, std::size_t> location(std::size_t pos) const;
+    void print(std::ostream& out) const;
+};
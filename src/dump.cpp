@@ -0,0 +1,212 @@
+#include "dump.hpp"
+#include "parser.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+
+using std::dynamic_pointer_cast;
+using std::shared_ptr;
+
+AstDumper::AstDumper(std::ostream& out)
+    : out { out }
+    , depth { 0 }
+{
+}
+
+void AstDumper::dump(const Program& program)
+{
+    for (auto decl : program.decls)
+        this->decl(decl);
+}
+
+void AstDumper::indent()
+{
+    for (int i = 0; i < depth; ++i)
+        out << "    ";
+}
+
+void AstDumper::slot(const Slot& slot)
+{
+    switch (slot.kind) {
+    case Slot::Kind::LOCAL:
+        out << "@l" << slot.index;
+        break;
+    case Slot::Kind::GLOBAL:
+        out << "@g" << slot.index;
+        break;
+    case Slot::Kind::FUNCTION:
+        out << "@f" << slot.index;
+        break;
+    case Slot::Kind::NATIVE:
+        out << "@n" << slot.index;
+        break;
+    case Slot::Kind::UNRESOLVED:
+        break;
+    }
+}
+
+void AstDumper::decl(const shared_ptr<Decl>& decl)
+{
+    if (auto var = dynamic_pointer_cast<VarDecl>(decl); var != nullptr) {
+        indent();
+        out << (var->var_type == TokenType::EXTERN ? "extern " : "auto ")
+            << var->type << ' ' << var->ident;
+        slot(var->slot);
+        out << ";\n";
+    } else if (auto fun = dynamic_pointer_cast<FunDecl>(decl); fun != nullptr) {
+        indent();
+        out << "fun " << fun->type << ' ' << fun->name << '(';
+        for (std::size_t i = 0; i < fun->param_list.size(); ++i)
+            out << (i ? ", " : "") << fun->param_list[i];
+        out << ") // #" << fun->index << ", frame " << fun->frame_size
+            << '\n';
+        statement(fun->comp_stmt);
+    } else if (auto native = dynamic_pointer_cast<NativeDecl>(decl);
+        native != nullptr) {
+        indent();
+        out << "extern fun " << native->type << ' ' << native->name << '(';
+        for (std::size_t i = 0; i < native->param_types.size(); ++i)
+            out << (i ? ", " : "") << native->param_types[i];
+        out << "); // #" << native->index << '\n';
+    } else if (auto import = dynamic_pointer_cast<ImportDecl>(decl);
+        import != nullptr) {
+        indent();
+        out << "import " << import->module << ";\n";
+    }
+}
+
+void AstDumper::statement(const shared_ptr<Stmt>& stmt)
+{
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr) {
+        indent();
+        out << "{\n";
+        ++depth;
+        for (auto decl : comp->decls)
+            this->decl(decl);
+        for (auto inner : comp->stmts)
+            statement(inner);
+        --depth;
+        indent();
+        out << "}\n";
+        return;
+    }
+
+    if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt); if_stmt != nullptr) {
+        indent();
+        out << "if (";
+        expression(if_stmt->cond);
+        out << ")\n";
+        ++depth;
+        statement(if_stmt->if_branch);
+        --depth;
+        if (if_stmt->else_branch) {
+            indent();
+            out << "else\n";
+            ++depth;
+            statement(if_stmt->else_branch);
+            --depth;
+        }
+        return;
+    }
+
+    if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr) {
+        indent();
+        out << "loop (";
+        expression(loop->cond);
+        out << (loop->rotated ? ") // tested at the bottom\n" : ")\n");
+        ++depth;
+        statement(loop->body);
+        --depth;
+        return;
+    }
+
+    if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt); loop != nullptr) {
+        indent();
+        out << "loop parallel (";
+        expression(loop->init);
+        out << ", ";
+        expression(loop->end);
+        out << ')';
+        for (std::size_t i = 0; i < loop->reductions.size(); ++i) {
+            out << (i ? ", " : " reduce (")
+                << loop->reductions[i].op.token_str << ' ';
+            expression(loop->reductions[i].var);
+        }
+        out << (loop->reductions.empty() ? "\n" : ")\n");
+        ++depth;
+        statement(loop->body);
+        --depth;
+        return;
+    }
+
+    indent();
+    if (auto expr_stmt = dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        expression(expr_stmt->expr);
+    else if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr) {
+        out << "return ";
+        expression(ret->expr);
+    } else if (dynamic_pointer_cast<BreakStmt>(stmt) != nullptr)
+        out << "break";
+    else if (dynamic_pointer_cast<ContStmt>(stmt) != nullptr)
+        out << "continue";
+    out << ";\n";
+}
+
+void AstDumper::expression(const shared_ptr<Expr>& expr)
+{
+    if (auto number = dynamic_pointer_cast<Number>(expr); number != nullptr) {
+        if (number->floating)
+            out << number->real;
+        else
+            out << number->number;
+    }
+
+    else if (auto str = dynamic_pointer_cast<String>(expr); str != nullptr)
+        out << str->str;
+
+    else if (auto ident = dynamic_pointer_cast<Ident>(expr); ident != nullptr) {
+        out << ident->name;
+        slot(ident->slot);
+    }
+
+    else if (auto assign = dynamic_pointer_cast<Assign>(expr);
+        assign != nullptr) {
+        expression(assign->ident);
+        out << " = ";
+        expression(assign->expr);
+    }
+
+    else if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr) {
+        out << unary->op.token_str;
+        expression(unary->expr);
+    }
+
+    else if (auto binary = dynamic_pointer_cast<Binary>(expr);
+        binary != nullptr) {
+        expression(binary->left);
+        out << ' ' << binary->op.token_str << ' ';
+        expression(binary->right);
+    }
+
+    else if (auto group = dynamic_pointer_cast<Grouping>(expr);
+        group != nullptr) {
+        out << '(';
+        expression(group->expr);
+        out << ')';
+    }
+
+    else if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr) {
+        if (call->tail)
+            out << "tail ";
+        out << call->name;
+        slot(call->slot);
+        out << '(';
+        for (std::size_t i = 0; i < call->exprs.size(); ++i) {
+            out << (i ? ", " : "");
+            expression(call->exprs[i]);
+        }
+        out << ')';
+    }
+}
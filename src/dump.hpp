@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+
+#include "parser.hpp"
+
+// Prints the tree back as annotated pseudo source for --dump-ast. Resolved
+// names carry their slot (@l local, @g global, @f function, @n native).
+class AstDumper {
+private:
+    std::ostream& out;
+    int depth;
+
+    void indent();
+    void decl(const std::shared_ptr<Decl>& decl);
+    void statement(const std::shared_ptr<Stmt>& stmt);
+    void expression(const std::shared_ptr<Expr>& expr);
+    void slot(const Slot& slot);
+
+public:
+    AstDumper(std::ostream& out);
+    void dump(const Program& program);
+};
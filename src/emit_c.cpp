@@ -0,0 +1,577 @@
+#include "emit_c.hpp"
+#include "parser.hpp"
+#include "purity.hpp"
+#include "types.hpp"
+#include "walk.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+
+static string c_type(const string& type)
+{
+    auto width { type_widths.find(type) };
+    if (width == type_widths.end())
+        return "int64_t";
+
+    const TypeWidth& bits { width->second };
+    if (bits.floating)
+        return bits.bits == 32 ? "float" : "double";
+    return (bits.is_signed ? "int" : "uint") + to_string(bits.bits) + "_t";
+}
+
+static bool floating(const string& type)
+{
+    auto width { type_widths.find(type) };
+    return width != type_widths.end() && width->second.floating;
+}
+
+// Octal escapes are always three digits, so a following digit cannot join
+static string c_literal(const string& text)
+{
+    static const char digits[] = "01234567";
+    string literal { "\"" };
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\' || c == '?')
+            literal += string { '\\' } + static_cast<char>(c);
+        else if (c >= 0x20 && c < 0x7f)
+            literal += static_cast<char>(c);
+        else
+            literal += string { '\\', digits[c >> 6], digits[(c >> 3) & 7],
+                digits[c & 7] };
+    }
+    return literal + "\"";
+}
+
+// What an extern function returned as an expression word, the way
+// NativeFunction hands it to the interpreter
+static string widen(const string& value, const string& type)
+{
+    if (floating(type))
+        return "lang_rt_from_double(" + value + ")";
+    return "(int64_t)" + value;
+}
+
+CEmitter::CEmitter(std::ostream& out)
+    : out { out }
+    , depth { 0 }
+    , program { nullptr }
+    , purity { nullptr }
+    , strings {}
+    , locals {}
+    , temps { 0 }
+{
+}
+
+void CEmitter::emit(const Program& program)
+{
+    this->program = &program;
+    purity = std::make_unique<Purity>(program);
+
+    strings.clear();
+    for (const auto& fun : program.functions)
+        walk_stmt(fun->comp_stmt, [&](const shared_ptr<Expr>& expr) {
+            if (auto str = dynamic_pointer_cast<String>(expr); str != nullptr)
+                strings.emplace(str->text, strings.size());
+        });
+
+    out << "/* Generated by lang --emit-c */\n"
+        << "#include <stdint.h>\n\n";
+    prelude();
+
+    if (!strings.empty())
+        out << '\n';
+    vector<const string*> texts(strings.size());
+    for (const auto& [text, index] : strings)
+        texts[index] = &text;
+    for (size_t i = 0; i < texts.size(); ++i)
+        out << "static const char lang_str_" << i << "[] = "
+            << c_literal(*texts[i]) << ";\n";
+
+    // Extern functions keep their C symbol under a name of our own, so
+    // neither libc's prototypes nor our helpers can clash with them
+    if (!program.natives.empty())
+        out << '\n';
+    for (const auto& native : program.natives) {
+        out << "extern " << c_type(native->type) << " lang_native_"
+            << native->name << '(';
+        for (size_t i = 0; i < native->param_types.size(); ++i)
+            out << (i ? ", " : "") << c_type(native->param_types[i]);
+        out << (native->param_types.empty() ? "void" : "")
+            << ") __asm__(LANG_SYMBOL(\"" << native->name << "\"));\n";
+    }
+
+    if (!program.globals.empty())
+        out << '\n';
+    for (size_t i = 0; i < program.globals.size(); ++i)
+        out << "static int64_t "
+            << name({ Slot::Kind::GLOBAL, i }) << ";\n";
+
+    auto signature = [&](const FunDecl& fun) {
+        out << "int64_t lang_" << fun.name << '(';
+        for (size_t i = 0; i < fun.param_list.size(); ++i)
+            out << (i ? ", " : "") << "int64_t p" << i;
+        out << (fun.param_list.empty() ? "void)" : ")");
+    };
+
+    out << '\n';
+    for (const auto& fun : program.functions) {
+        signature(*fun);
+        out << ";\n";
+    }
+
+    for (const auto& fun : program.functions) {
+        out << '\n';
+        signature(*fun);
+        out << '\n';
+        function(*fun);
+    }
+
+    for (const auto& fun : program.functions) {
+        if (fun->name != "main")
+            continue;
+
+        out << "\n#ifndef LANG_NO_MAIN\n"
+            << "int main(void)\n"
+            << "{\n"
+            << "    lang_rt_printf(\"INFO: main returned %lld\\n\", "
+               "(long long)lang_main(";
+        for (size_t i = 0; i < fun->param_list.size(); ++i)
+            out << (i ? ", 0" : "0");
+        out << "));\n"
+            << "    return 0;\n"
+            << "}\n"
+            << "#endif\n";
+    }
+}
+
+// Wrapping arithmetic and the runtime errors of the interpreter
+void CEmitter::prelude()
+{
+    out << "#define LANG_STR(x) #x\n"
+           "#define LANG_XSTR(x) LANG_STR(x)\n"
+           "#define LANG_SYMBOL(name) LANG_XSTR(__USER_LABEL_PREFIX__) name\n"
+           "\n"
+           "extern int lang_rt_printf(const char* format, ...)\n"
+           "    __asm__(LANG_SYMBOL(\"printf\"));\n"
+           "extern int lang_rt_dprintf(int fd, const char* format, ...)\n"
+           "    __asm__(LANG_SYMBOL(\"dprintf\"));\n"
+           "extern void lang_rt_exit(int status) __asm__(LANG_SYMBOL(\"exit\"));\n"
+           "\n"
+           "static inline void lang_rt_fail(const char* message)\n"
+           "{\n"
+           "    lang_rt_dprintf(2, \"ERROR: %s\\n\", message);\n"
+           "    lang_rt_exit(1);\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_add(int64_t a, int64_t b)\n"
+           "{\n"
+           "    return (int64_t)((uint64_t)a + (uint64_t)b);\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_sub(int64_t a, int64_t b)\n"
+           "{\n"
+           "    return (int64_t)((uint64_t)a - (uint64_t)b);\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_mul(int64_t a, int64_t b)\n"
+           "{\n"
+           "    return (int64_t)((uint64_t)a * (uint64_t)b);\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_neg(int64_t a)\n"
+           "{\n"
+           "    return (int64_t)(0 - (uint64_t)a);\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_div(int64_t a, int64_t b)\n"
+           "{\n"
+           "    if (b == 0)\n"
+           "        lang_rt_fail(\"Division by zero\");\n"
+           "    return b == -1 ? lang_rt_neg(a) : a / b;\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_mod(int64_t a, int64_t b)\n"
+           "{\n"
+           "    if (b == 0)\n"
+           "        lang_rt_fail(\"Division by zero\");\n"
+           "    return b == -1 ? 0 : a % b;\n"
+           "}\n"
+           "\n"
+           "static inline int64_t lang_rt_from_double(double value)\n"
+           "{\n"
+           "    return (value < 0 ? -value : value) < 0x1p63 ? (int64_t)value "
+           ": 0;\n"
+           "}\n";
+}
+
+void CEmitter::indent()
+{
+    for (int i = 0; i < depth; ++i)
+        out << "    ";
+}
+
+// Every slot of the frame is one C variable, declared and zeroed up front:
+// like the interpreter's frame, a local keeps its value when its block is
+// entered again
+void CEmitter::function(const FunDecl& fun)
+{
+    locals.assign(fun.frame_size, "");
+    temps = 0;
+
+    for (size_t i = 0; i < fun.param_list.size(); ++i)
+        locals[i] = "l" + to_string(i) + "_" + fun.param_list[i];
+
+    auto declare = [&](auto& self, const shared_ptr<Stmt>& stmt) -> void {
+        if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr) {
+            for (const auto& decl : comp->decls) {
+                auto var { dynamic_pointer_cast<VarDecl>(decl) };
+                if (var == nullptr || var->slot.kind != Slot::Kind::LOCAL)
+                    continue;
+                size_t slot { var->slot.index };
+                if (locals[slot].empty())
+                    locals[slot] = "l" + to_string(slot) + "_" + var->ident;
+            }
+            for (const auto& inner : comp->stmts)
+                self(self, inner);
+        } else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+            if_stmt != nullptr) {
+            self(self, if_stmt->if_branch);
+            self(self, if_stmt->else_branch);
+        } else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt);
+            loop != nullptr)
+            self(self, loop->body);
+        else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+            loop != nullptr)
+            self(self, loop->body);
+    };
+    declare(declare, fun.comp_stmt);
+
+    out << "{\n";
+    depth = 1;
+    for (size_t slot = 0; slot < fun.frame_size; ++slot) {
+        if (locals[slot].empty())
+            locals[slot] = "l" + to_string(slot);
+        indent();
+        out << "int64_t " << locals[slot] << " = "
+            << (slot < fun.param_list.size() ? "p" + to_string(slot) : "0")
+            << ";\n";
+    }
+
+    for (const auto& stmt : fun.comp_stmt->stmts)
+        statement(stmt);
+
+    indent();
+    out << "return 0;\n";
+    depth = 0;
+    out << "}\n";
+}
+
+void CEmitter::statement(const shared_ptr<Stmt>& stmt)
+{
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr) {
+        indent();
+        out << "{\n";
+        ++depth;
+        for (const auto& inner : comp->stmts)
+            statement(inner);
+        --depth;
+        indent();
+        out << "}\n";
+        return;
+    }
+
+    if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt); if_stmt != nullptr) {
+        indent();
+        out << "if (" << expression(if_stmt->cond) << ")\n";
+        block(if_stmt->if_branch);
+        if (if_stmt->else_branch) {
+            indent();
+            out << "else\n";
+            block(if_stmt->else_branch);
+        }
+        return;
+    }
+
+    if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr) {
+        indent();
+        if (!loop->rotated) {
+            out << "while (" << expression(loop->cond) << ")\n";
+            block(loop->body);
+            return;
+        }
+        out << "do\n";
+        block(loop->body);
+        indent();
+        out << "while (" << expression(loop->cond) << ");\n";
+        return;
+    }
+
+    // Iterations in order on this thread, leaving the index at hi
+    if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt); loop != nullptr) {
+        auto init { dynamic_pointer_cast<Assign>(loop->init) };
+        string lo { "lang_tmp_" + to_string(++temps) };
+        string hi { "lang_tmp_" + to_string(++temps) };
+        string i { "lang_tmp_" + to_string(++temps) };
+        string index { name(init->slot) };
+
+        indent();
+        out << "{\n";
+        ++depth;
+        indent();
+        out << "int64_t " << lo << " = " << expression(loop->init) << ";\n";
+        indent();
+        out << "int64_t " << hi << " = " << expression(loop->end) << ";\n";
+        indent();
+        out << "for (int64_t " << i << " = " << lo << "; " << i << " < " << hi
+            << "; ++" << i << ") {\n";
+        ++depth;
+        indent();
+        out << index << " = " << i << ";\n";
+        statement(loop->body);
+        --depth;
+        indent();
+        out << "}\n";
+        indent();
+        out << "if (" << lo << " < " << hi << ")\n";
+        indent();
+        out << "    " << index << " = " << hi << ";\n";
+        --depth;
+        indent();
+        out << "}\n";
+        return;
+    }
+
+    indent();
+    if (auto expr_stmt = dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        out << "(void)" << expression(expr_stmt->expr) << ";\n";
+    else if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr)
+        out << "return " << (ret->expr ? expression(ret->expr) : "0") << ";\n";
+    else if (dynamic_pointer_cast<BreakStmt>(stmt) != nullptr)
+        out << "break;\n";
+    else if (dynamic_pointer_cast<ContStmt>(stmt) != nullptr)
+        out << "continue;\n";
+    else
+        out << ";\n";
+}
+
+// Branches and bodies always get braces, which settles any dangling else
+void CEmitter::block(const shared_ptr<Stmt>& stmt)
+{
+    if (dynamic_pointer_cast<CompStmt>(stmt) != nullptr) {
+        statement(stmt);
+        return;
+    }
+
+    indent();
+    out << "{\n";
+    ++depth;
+    statement(stmt);
+    --depth;
+    indent();
+    out << "}\n";
+}
+
+string CEmitter::expression(const shared_ptr<Expr>& expr)
+{
+    if (auto number = dynamic_pointer_cast<Number>(expr); number != nullptr)
+        return number->number == INT64_MIN
+            ? "INT64_MIN"
+            : "INT64_C(" + to_string(number->number) + ")";
+
+    if (auto str = dynamic_pointer_cast<String>(expr); str != nullptr)
+        return "(int64_t)(intptr_t)lang_str_"
+            + to_string(strings.at(str->text));
+
+    if (auto ident = dynamic_pointer_cast<Ident>(expr); ident != nullptr)
+        return read(ident->slot);
+
+    if (auto assign = dynamic_pointer_cast<Assign>(expr); assign != nullptr)
+        return "(" + name(assign->slot) + " = " + expression(assign->expr)
+            + ")";
+
+    if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr) {
+        string value { expression(unary->expr) };
+        switch (unary->op.token_type) {
+        case TokenType::SUB:
+            return "lang_rt_neg(" + value + ")";
+        case TokenType::NOT:
+            return "(int64_t)!" + value;
+        default:
+            return value;
+        }
+    }
+
+    if (auto binary = dynamic_pointer_cast<Binary>(expr); binary != nullptr) {
+        string helper {};
+        string op {};
+        switch (binary->op.token_type) {
+        case TokenType::ADD:
+            helper = "lang_rt_add";
+            break;
+        case TokenType::SUB:
+            helper = "lang_rt_sub";
+            break;
+        case TokenType::MUL:
+            helper = "lang_rt_mul";
+            break;
+        case TokenType::DIV:
+            helper = "lang_rt_div";
+            break;
+        case TokenType::MOD:
+            helper = "lang_rt_mod";
+            break;
+        case TokenType::GT:
+        case TokenType::LT:
+        case TokenType::GTE:
+        case TokenType::LTE:
+        case TokenType::DEQ:
+            op = binary->op.token_str;
+            break;
+        case TokenType::NEQ:
+            op = "!=";
+            break;
+        default:
+            throw std::runtime_error(
+                "ERROR: Unsupported operator " + binary->op.token_str);
+        }
+
+        return sequenced({ binary->left, binary->right },
+            [&](const vector<string>& operands) {
+                if (!helper.empty())
+                    return helper + "(" + operands[0] + ", " + operands[1]
+                        + ")";
+                return "(int64_t)(" + operands[0] + " " + op + " "
+                    + operands[1] + ")";
+            });
+    }
+
+    if (auto group = dynamic_pointer_cast<Grouping>(expr); group != nullptr)
+        return "(" + expression(group->expr) + ")";
+
+    if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr)
+        return this->call(*call);
+
+    throw std::runtime_error("ERROR: Cannot translate expression to C");
+}
+
+// C leaves the order of operands open where the interpreter goes left to
+// right. When that can matter, the operands go through temporaries in order.
+string CEmitter::sequenced(const vector<shared_ptr<Expr>>& operands,
+    const std::function<string(const vector<string>&)>& combine)
+{
+    vector<string> values {};
+    bool ordered { false };
+    for (const auto& operand : operands) {
+        values.push_back(expression(operand));
+        ordered = ordered || effects(operand);
+    }
+    if (!ordered)
+        return combine(values);
+
+    string result { "({ " };
+    for (auto& value : values) {
+        string temp { "lang_tmp_" + to_string(++temps) };
+        result += "int64_t " + temp + " = " + value + "; ";
+        value = temp;
+    }
+    return result + combine(values) + "; })";
+}
+
+// Missing arguments are 0 and extra ones are evaluated but dropped, as in
+// the interpreter
+string CEmitter::call(const FunCall& call)
+{
+    if (call.slot.kind == Slot::Kind::NATIVE) {
+        const NativeDecl& native { *program->natives[call.slot.index] };
+        return sequenced(call.exprs, [&](const vector<string>& args) {
+            string text { "lang_native_" + native.name + "(" };
+            for (size_t i = 0; i < args.size(); ++i)
+                text += (i ? ", " : "") + args[i];
+            return widen(text + ")", native.type);
+        });
+    }
+
+    const FunDecl& fun { *program->functions[call.slot.index] };
+    return sequenced(call.exprs, [&](const vector<string>& args) {
+        string text { "lang_" + fun.name + "(" };
+        for (size_t i = 0; i < fun.param_list.size(); ++i)
+            text += (i ? ", " : "") + (i < args.size() ? args[i] : "0");
+        return text + ")";
+    });
+}
+
+string CEmitter::read(const Slot& slot)
+{
+    if (slot.kind == Slot::Kind::FUNCTION || slot.kind == Slot::Kind::NATIVE)
+        return "INT64_C(" + to_string(slot.index) + ")";
+    return name(slot);
+}
+
+string CEmitter::name(const Slot& slot)
+{
+    if (slot.kind == Slot::Kind::LOCAL)
+        return locals[slot.index];
+    return "g" + to_string(slot.index) + "_"
+        + program->globals[slot.index]->ident;
+}
+
+// Could change what another operand sees: writes, and calls that may write
+bool CEmitter::effects(const shared_ptr<Expr>& expr) const
+{
+    bool found { false };
+    walk_expr(expr, [&](const shared_ptr<Expr>& node) {
+        if (dynamic_pointer_cast<Assign>(node) != nullptr)
+            found = true;
+        else if (auto call = dynamic_pointer_cast<FunCall>(node);
+            call != nullptr
+            && (call->slot.kind == Slot::Kind::NATIVE
+                || !purity->pure(call->slot.index)))
+            found = true;
+    });
+    return found;
+}
+
+static string quote(const string& arg)
+{
+    string quoted { "'" };
+    for (char c : arg)
+        quoted += c == '\'' ? string { "'\\''" } : string { c };
+    return quoted + "'";
+}
+
+bool compile_c(const string& source, const string& output,
+    const vector<string>& libraries, std::ostream& log)
+{
+    const char* cc { std::getenv("CC") };
+    string command { cc != nullptr && *cc != '\0' ? cc : "cc" };
+    command += " -O2";
+
+    bool shared { output.size() > 3
+        && output.compare(output.size() - 3, 3, ".so") == 0 };
+    if (shared)
+        command += " -shared -fPIC -DLANG_NO_MAIN";
+
+    command += " " + quote(source) + " -o " + quote(output);
+    for (const auto& library : libraries)
+        command += " " + quote(library);
+    command += " -lm";
+
+    log << "INFO: Running " << command << '\n';
+    log.flush();
+    return std::system(command.c_str()) == 0;
+}
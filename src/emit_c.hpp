@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+#include "purity.hpp"
+
+// Translates a resolved Program into one C file for --emit-c. Like the
+// interpreter, every variable, parameter and result is a 64 bit word
+// (int64_t, with wrapping arithmetic) whatever its declared type; values
+// only take their declared C types when passed to or returned from extern
+// functions. Functions become lang_<name>, extern functions are bound to
+// their C symbol and a main() that prints the result of lang_main is added
+// unless LANG_NO_MAIN is defined.
+// Parallel loops run serially. Needs GNU C (statement expressions and asm
+// labels), which gcc and clang both accept.
+class CEmitter {
+private:
+    std::ostream& out;
+    int depth;
+    const Program* program;
+    std::unique_ptr<Purity> purity; // calls to pure functions are unordered
+    std::map<std::string, std::size_t> strings; // text to lang_str_<n>
+    std::vector<std::string> locals; // C names, by slot
+    std::size_t temps; // lang_tmp_<n> of the current function
+
+    void indent();
+    void prelude();
+    void function(const FunDecl& fun);
+    void statement(const std::shared_ptr<Stmt>& stmt);
+    void block(const std::shared_ptr<Stmt>& stmt);
+    std::string expression(const std::shared_ptr<Expr>& expr);
+    std::string sequenced(const std::vector<std::shared_ptr<Expr>>& operands,
+        const std::function<std::string(const std::vector<std::string>&)>&
+            combine);
+    std::string call(const FunCall& call);
+    std::string read(const Slot& slot);
+    std::string name(const Slot& slot);
+    bool effects(const std::shared_ptr<Expr>& expr) const;
+
+public:
+    CEmitter(std::ostream& out);
+    void emit(const Program& program);
+};
+
+// Compiles source with $CC (cc if unset) at -O2 into output, a shared
+// object when it ends in .so, linking libraries. False if the compiler
+// failed.
+bool compile_c(const std::string& source, const std::string& output,
+    const std::vector<std::string>& libraries, std::ostream& log);
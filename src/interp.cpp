@@ -0,0 +1,602 @@
+#include "interp.hpp"
+#include "optimize.hpp"
+#include "parser.hpp"
+#include "purity.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <pthread.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+// Lowest address call() may take its native stack to on this thread, with
+// room left for the expressions one call nests into. Null if unknown.
+static const char* native_stack_limit()
+{
+    thread_local const char* limit = [] {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+            return static_cast<const char*>(nullptr);
+
+        void* low { nullptr };
+        size_t size { 0 };
+        pthread_attr_getstack(&attr, &low, &size);
+        pthread_attr_destroy(&attr);
+        return static_cast<const char*>(low)
+            + std::min<size_t>(size / 4, 256 << 10);
+    }();
+    return limit;
+}
+
+// Signed arithmetic that wraps instead of being undefined
+static int64_t wrap(uint64_t value) { return static_cast<int64_t>(value); }
+
+Interpreter::Interpreter(const Program& program, TierOptions options,
+    const NativeLibraries* libraries)
+    : program { program }
+    , options { options }
+    , inliner { options.opts.inline_budget }
+    , functions {}
+    , own_globals(program.globals.size(), 0)
+    , globals { own_globals.data() }
+    , stack {}
+    , frames {}
+    , ret { 0 }
+    , tail_fun { 0 }
+    , tail_args { 0 }
+    , start { std::chrono::steady_clock::now() }
+    , sampled { nullptr }
+    , libraries { libraries }
+    , natives {}
+    , pool { nullptr }
+    , memos {}
+    , unmemoized {}
+{
+    for (auto fun : program.functions)
+        functions.push_back({ fun, nullptr, {}, 0, 0, 0, std::nullopt });
+
+    stack.reserve(1 << 16);
+}
+
+// Tiering stays with the parent: promoting here would race with the other
+// participants, so calls run whichever tier the parent had at the start
+Interpreter::Interpreter(const Interpreter& parent, const ParLoopStmt& loop)
+    : program { parent.program }
+    , options { parent.options }
+    , inliner { parent.options.opts.inline_budget }
+    , functions { parent.functions }
+    , own_globals {}
+    , globals { parent.globals }
+    , stack { parent.stack.begin() + parent.frames.back().base,
+        parent.stack.end() }
+    , frames {}
+    , ret { 0 }
+    , tail_fun { 0 }
+    , tail_args { 0 }
+    , start { parent.start }
+    , sampled { nullptr }
+    , libraries { parent.libraries }
+    , natives { parent.natives }
+    , pool { nullptr }
+    , memos {}
+    , unmemoized {}
+{
+    options.enabled = false;
+    size_t fun = parent.frames.back().fun - parent.functions.data();
+    frames.push_back({ &functions[fun], Tier::OPTIMIZED, 0, 0 });
+    stack.reserve(1 << 16);
+
+    for (const auto& reduction : loop.reductions)
+        variable(reduction.var->slot)
+            = reduction.op.token_type == TokenType::MUL;
+}
+
+int64_t Interpreter::run(const string& entry)
+{
+    auto found { std::find_if(program.functions.begin(),
+        program.functions.end(),
+        [&](const auto& fun) { return fun->name == entry; }) };
+    if (found == program.functions.end())
+        throw runtime_error("ERROR: No function named " + entry);
+
+    bind();
+    stack.clear();
+    frames.clear();
+    start = std::chrono::steady_clock::now();
+
+    return call((*found)->index, stack.size());
+}
+
+int64_t Interpreter::invoke(size_t fun, const int64_t* args, size_t count)
+{
+    bind();
+    stack.clear();
+    frames.clear();
+    stack.insert(stack.end(), args, args + count);
+    return call(fun, 0);
+}
+
+// Extern functions are bound before anything runs
+void Interpreter::bind()
+{
+    if (natives.size() == program.natives.size())
+        return;
+
+    if (libraries == nullptr)
+        throw runtime_error("ERROR: No native libraries to bind "
+            + program.natives.front()->name + " against");
+    natives.clear();
+    for (const auto& native : program.natives)
+        natives.emplace_back(*native, *libraries);
+}
+
+int64_t Interpreter::call(size_t fun, size_t base)
+{
+    char here;
+    if (frames.size() >= max_call_depth || &here < native_stack_limit())
+        throw runtime_error("ERROR: Call stack overflow");
+
+    // The first memoized function of a chain of tail calls caches the
+    // result of the whole chain
+    MemoCache* memo { nullptr };
+    int64_t key[max_memo_args];
+
+    while (true) {
+        Function& callee { functions[fun] };
+        if (options.enabled && callee.optimized == nullptr
+            && ++callee.calls >= options.call_threshold)
+            promote(callee, false);
+
+        Tier tier { options.enabled && callee.optimized == nullptr
+                ? Tier::BASELINE
+                : Tier::OPTIMIZED };
+        const FunDecl& decl { callee.optimized ? *callee.optimized
+                                               : *callee.baseline };
+
+        // Extra arguments must not end up as initial values of locals
+        stack.resize(std::min(stack.size(), base + decl.param_list.size()));
+        stack.resize(base + decl.frame_size, 0);
+
+        if (MemoCache* cache = memos.empty() ? nullptr : memos[fun].get()) {
+            int64_t value;
+            if (cache->find(stack.data() + base, value)) {
+                stack.resize(base);
+                if (memo != nullptr)
+                    memo->insert(key, value);
+                return value;
+            }
+            if (memo == nullptr) {
+                memo = cache;
+                std::copy(stack.begin() + base,
+                    stack.begin() + base + decl.param_list.size(), key);
+            }
+        }
+
+        frames.push_back({ &callee, tier, base, 0 });
+        if (sampled)
+            sampled->push(fun);
+
+        Flow flow { statement(decl.comp_stmt.get()) };
+
+        if (sampled)
+            sampled->pop();
+        frames.pop_back();
+
+        if (flow != Flow::TAIL) {
+            stack.resize(base);
+            int64_t result { flow == Flow::RETURN ? ret : 0 };
+            if (memo != nullptr)
+                memo->insert(key, result);
+            return result;
+        }
+
+        // Tail call: reuse this activation instead of nesting a new one,
+        // its arguments move down from the top of the stack
+        fun = tail_fun;
+        std::copy(stack.end() - tail_args, stack.end(), stack.begin() + base);
+        stack.resize(base + tail_args);
+    }
+}
+
+int64_t& Interpreter::variable(const Slot& slot)
+{
+    if (slot.kind == Slot::Kind::LOCAL)
+        return stack[frames.back().base + slot.index];
+    return globals[slot.index];
+}
+
+Interpreter::Flow Interpreter::statement(const Stmt* stmt)
+{
+    switch (stmt->kind()) {
+    case StmtKind::EXPR:
+        expression(static_cast<const ExprStmt*>(stmt)->expr.get());
+        return Flow::NEXT;
+
+    case StmtKind::COMP:
+        for (const auto& inner : static_cast<const CompStmt*>(stmt)->stmts)
+            if (Flow flow { statement(inner.get()) }; flow != Flow::NEXT)
+                return flow;
+        return Flow::NEXT;
+
+    case StmtKind::IF: {
+        auto if_stmt { static_cast<const IfStmt*>(stmt) };
+        if (expression(if_stmt->cond.get()))
+            return statement(if_stmt->if_branch.get());
+        if (if_stmt->else_branch)
+            return statement(if_stmt->else_branch.get());
+        return Flow::NEXT;
+    }
+
+    case StmtKind::LOOP:
+        return loop(static_cast<const LoopStmt*>(stmt));
+
+    case StmtKind::PARLOOP:
+        return par_loop(static_cast<const ParLoopStmt*>(stmt));
+
+    case StmtKind::RET: {
+        const Expr* expr { static_cast<const RetStmt*>(stmt)->expr.get() };
+        while (expr != nullptr && expr->kind() == ExprKind::GROUPING)
+            expr = static_cast<const Grouping*>(expr)->expr.get();
+
+        if (expr != nullptr && expr->kind() == ExprKind::FUNCALL
+            && static_cast<const FunCall*>(expr)->tail) {
+            auto call { static_cast<const FunCall*>(expr) };
+            for (const auto& arg : call->exprs) {
+                int64_t value { expression(arg.get()) };
+                stack.push_back(value);
+            }
+            tail_args = call->exprs.size();
+            tail_fun = call->slot.index;
+            return Flow::TAIL;
+        }
+
+        ret = expr ? expression(expr) : 0;
+        return Flow::RETURN;
+    }
+
+    case StmtKind::BREAK:
+        return Flow::BREAK;
+
+    case StmtKind::CONT:
+        return Flow::CONTINUE;
+
+    case StmtKind::EMPTY:
+        return Flow::NEXT;
+    }
+
+    return Flow::NEXT;
+}
+
+Interpreter::Flow Interpreter::loop(const LoopStmt* loop)
+{
+    Function* fun { frames.back().fun };
+    bool counting { frames.back().tier == Tier::BASELINE };
+    bool outermost { frames.back().loop_depth++ == 0 };
+    Flow result { Flow::NEXT };
+
+    if (loop->rotated || expression(loop->cond.get())) {
+        while (true) {
+            Flow flow { statement(loop->body.get()) };
+            if (flow == Flow::BREAK)
+                break;
+            if (flow == Flow::RETURN || flow == Flow::TAIL) {
+                result = flow;
+                break;
+            }
+
+            if (counting) {
+                if (fun->optimized == nullptr
+                    && ++fun->back_edges >= options.loop_threshold)
+                    promote(*fun, true);
+
+                // On-stack replacement: the rest of this loop runs in the
+                // optimized tier, with the frame grown to its layout
+                if (auto entry = fun->osr.find(loop);
+                    outermost && entry != fun->osr.end()) {
+                    ++fun->osr_entries;
+                    Frame& frame { frames.back() };
+                    frame.tier = Tier::OPTIMIZED;
+                    stack.resize(frame.base + fun->optimized->frame_size, 0);
+                    --frame.loop_depth;
+                    return statement(entry->second.get());
+                }
+            }
+
+            if (!expression(loop->cond.get()))
+                break;
+        }
+    }
+
+    --frames.back().loop_depth;
+    return result;
+}
+
+// Iterations are dealt out in chunks; every participant runs its chunks in
+// its own context and the partial reductions are folded in at the end.
+// Wrapping + and * are associative and commutative, so the result does not
+// depend on how the range was split.
+Interpreter::Flow Interpreter::par_loop(const ParLoopStmt* loop)
+{
+    auto init { static_cast<const Assign*>(loop->init.get()) };
+    int64_t begin { expression(init) };
+    int64_t end { expression(loop->end.get()) };
+    if (begin >= end)
+        return Flow::NEXT;
+
+    if (pool == nullptr || pool->size() == 1) {
+        iterations(loop, begin, end);
+        variable(init->slot) = end;
+        return Flow::NEXT;
+    }
+
+    vector<std::unique_ptr<Interpreter>> contexts(pool->size());
+    pool->run(begin, end, 0, [&](size_t self, int64_t from, int64_t to) {
+        if (contexts[self] == nullptr)
+            contexts[self].reset(new Interpreter { *this, *loop });
+        contexts[self]->iterations(loop, from, to);
+    });
+
+    for (const auto& context : contexts) {
+        if (context == nullptr)
+            continue;
+        for (const auto& reduction : loop->reductions) {
+            uint64_t total = variable(reduction.var->slot);
+            uint64_t part = context->variable(reduction.var->slot);
+            variable(reduction.var->slot)
+                = wrap(reduction.op.token_type == TokenType::MUL
+                        ? total * part
+                        : total + part);
+        }
+    }
+
+    variable(init->slot) = end;
+    return Flow::NEXT;
+}
+
+void Interpreter::iterations(
+    const ParLoopStmt* loop, int64_t begin, int64_t end)
+{
+    const Slot& index { static_cast<const Assign*>(loop->init.get())->slot };
+    for (int64_t i = begin; i < end; ++i) {
+        variable(index) = i;
+        Flow flow { statement(loop->body.get()) };
+        if (flow != Flow::NEXT && flow != Flow::CONTINUE)
+            throw runtime_error("ERROR: A parallel loop body cannot leave "
+                                "the loop");
+    }
+}
+
+int64_t Interpreter::expression(const Expr* expr)
+{
+    switch (expr->kind()) {
+    case ExprKind::IDENT: {
+        const Slot& slot { static_cast<const Ident*>(expr)->slot };
+        if (slot.kind == Slot::Kind::FUNCTION)
+            return static_cast<int64_t>(slot.index);
+        return variable(slot);
+    }
+
+    case ExprKind::NUMBER:
+        return static_cast<const Number*>(expr)->number;
+
+    case ExprKind::BINARY: {
+        auto binary { static_cast<const Binary*>(expr) };
+        uint64_t left = expression(binary->left.get());
+        uint64_t right = expression(binary->right.get());
+        int64_t l { wrap(left) };
+        int64_t r { wrap(right) };
+
+        switch (binary->op.token_type) {
+        case TokenType::ADD:
+            return wrap(left + right);
+        case TokenType::SUB:
+            return wrap(left - right);
+        case TokenType::MUL:
+            return wrap(left * right);
+        case TokenType::DIV:
+        case TokenType::MOD:
+            if (r == 0)
+                throw runtime_error("ERROR: Division by zero");
+            if (r == -1) // INT64_MIN / -1 overflows
+                return binary->op.token_type == TokenType::DIV ? wrap(-left)
+                                                               : 0;
+            return binary->op.token_type == TokenType::DIV ? l / r : l % r;
+        case TokenType::GT:
+            return l > r;
+        case TokenType::LT:
+            return l < r;
+        case TokenType::GTE:
+            return l >= r;
+        case TokenType::LTE:
+            return l <= r;
+        case TokenType::DEQ:
+            return l == r;
+        case TokenType::NEQ:
+            return l != r;
+        default:
+            throw runtime_error(
+                "ERROR: Unsupported operator " + binary->op.token_str);
+        }
+    }
+
+    case ExprKind::ASSIGN: {
+        auto assign { static_cast<const Assign*>(expr) };
+        int64_t value { expression(assign->expr.get()) };
+        variable(assign->slot) = value;
+        return value;
+    }
+
+    case ExprKind::GROUPING:
+        return expression(static_cast<const Grouping*>(expr)->expr.get());
+
+    case ExprKind::FUNCALL: {
+        auto call { static_cast<const FunCall*>(expr) };
+        if (call->slot.kind == Slot::Kind::NATIVE) {
+            int64_t args[max_native_args];
+            for (size_t i = 0; i < call->exprs.size(); ++i)
+                args[i] = expression(call->exprs[i].get());
+            return natives[call->slot.index].call(args);
+        }
+
+        // Arguments land right where the callee's frame will start
+        size_t base { stack.size() };
+        for (const auto& arg : call->exprs) {
+            int64_t value { expression(arg.get()) };
+            stack.push_back(value);
+        }
+        return this->call(call->slot.index, base);
+    }
+
+    case ExprKind::UNARY: {
+        auto unary { static_cast<const Unary*>(expr) };
+        uint64_t value = expression(unary->expr.get());
+        switch (unary->op.token_type) {
+        case TokenType::SUB:
+            return wrap(-value);
+        case TokenType::NOT:
+            return value == 0;
+        default:
+            return wrap(value);
+        }
+    }
+
+    case ExprKind::STRING:
+        return reinterpret_cast<int64_t>(
+            static_cast<const String*>(expr)->text.c_str());
+    }
+
+    throw runtime_error("ERROR: Cannot evaluate expression");
+}
+
+// Builds the optimized tier of fun, plus an entry for each outermost loop of
+// the baseline body so running activations can switch over mid loop
+void Interpreter::promote(Function& fun, bool by_loop)
+{
+    auto optimized { clone_function(*fun.baseline) };
+    shared_ptr<Stmt> body { optimized->comp_stmt };
+    inliner.run(program, body);
+    if (options.opts.tail_calls)
+        TailCalls {}.run(*optimized);
+    if (options.opts.loop_opts)
+        for (auto& stmt : optimized->comp_stmt->stmts)
+            LoopOptimizer {}.run(*optimized, stmt);
+
+    vector<shared_ptr<Stmt>> loops {};
+    auto outermost = [&](auto& self, const shared_ptr<Stmt>& stmt) -> void {
+        if (dynamic_pointer_cast<LoopStmt>(stmt) != nullptr)
+            loops.push_back(stmt);
+        else if (auto comp = dynamic_pointer_cast<CompStmt>(stmt))
+            for (const auto& inner : comp->stmts)
+                self(self, inner);
+        else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt)) {
+            self(self, if_stmt->if_branch);
+            self(self, if_stmt->else_branch);
+        }
+    };
+    outermost(outermost, fun.baseline->comp_stmt);
+
+    for (const auto& loop : loops) {
+        auto entry { clone_stmt(loop) };
+        inliner.run(program, entry);
+        if (options.opts.loop_opts)
+            LoopOptimizer {}.run(*optimized, entry);
+        fun.osr[loop.get()] = entry;
+    }
+
+    fun.optimized = optimized;
+    std::chrono::duration<double, std::milli> elapsed {
+        std::chrono::steady_clock::now() - start
+    };
+    fun.promotion = Promotion { elapsed.count(), fun.calls, fun.back_edges,
+        by_loop };
+}
+
+size_t Interpreter::memoize(size_t capacity)
+{
+    Purity purity { program };
+    memos.clear();
+    memos.resize(program.functions.size());
+    unmemoized.assign(program.functions.size(), "");
+
+    size_t cached { 0 };
+    for (size_t fun = 0; fun < program.functions.size(); ++fun) {
+        size_t params { program.functions[fun]->param_list.size() };
+        if (!purity.pure(fun))
+            unmemoized[fun] = purity.reason(fun);
+        else if (params > max_memo_args)
+            unmemoized[fun] = "takes more than "
+                + std::to_string(max_memo_args) + " arguments";
+        else if (capacity == 0)
+            unmemoized[fun] = "the cache size is 0";
+        else {
+            memos[fun] = std::make_unique<MemoCache>(params, capacity);
+            ++cached;
+        }
+    }
+
+    return cached;
+}
+
+void Interpreter::print_memo_stats(std::ostream& out) const
+{
+    for (size_t fun = 0; fun < memos.size(); ++fun) {
+        out << "MEMO: " << program.functions[fun]->name;
+        if (memos[fun] == nullptr) {
+            out << " not memoized, " << unmemoized[fun] << '\n';
+            continue;
+        }
+
+        const MemoCache& cache { *memos[fun] };
+        size_t lookups { cache.hits + cache.misses };
+        out << ' ' << cache.hits << " hit(s) in " << lookups << " call(s)";
+        if (lookups > 0)
+            out << " (" << std::fixed << std::setprecision(1)
+                << 100.0 * cache.hits / lookups << std::defaultfloat
+                << "% hit rate)";
+        out << ", " << cache.size() << " result(s) cached, "
+            << cache.evictions << " eviction(s)\n";
+    }
+}
+
+void Interpreter::print_tier_stats(std::ostream& out) const
+{
+    if (!options.enabled) {
+        out << "TIER: tiering disabled, the program was optimized up front\n";
+        return;
+    }
+
+    for (const auto& fun : functions) {
+        out << "TIER: " << fun.baseline->name;
+        if (!fun.promotion.has_value()) {
+            out << " stayed in baseline after " << fun.calls << " call(s), "
+                << fun.back_edges << " back-edge(s)\n";
+            continue;
+        }
+
+        const auto& promotion { fun.promotion.value() };
+        out << " promoted at " << promotion.at_ms << " ms after "
+            << promotion.calls << " call(s), " << promotion.back_edges
+            << " back-edge(s): "
+            << (promotion.by_loop ? "back-edge threshold "
+                                  : "call threshold ")
+            << (promotion.by_loop ? options.loop_threshold
+                                  : options.call_threshold)
+            << " reached";
+        if (fun.osr_entries > 0)
+            out << ", entered " << fun.osr_entries << " time(s) mid loop";
+        out << '\n';
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memo.hpp"
+#include "native.hpp"
+#include "optimize.hpp"
+#include "parser.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+
+// Most nested calls. call() also stops short of the end of the native stack
+// of the thread it runs on, which may come first on small thread stacks.
+inline constexpr std::size_t max_call_depth { 20000 };
+
+// When a function leaves the baseline tier
+struct TierOptions {
+    bool enabled;
+    std::size_t call_threshold; // calls before promotion
+    std::size_t loop_threshold; // loop back-edges before promotion
+    OptOptions opts; // pipeline used to build the optimized tier
+};
+
+// Tree walking interpreter over a resolved Program. Every value is a 64 bit
+// word; strings evaluate to the address of their text.
+//
+// With tiering, functions start out running their resolved but unoptimized
+// tree and count calls and loop back-edges. Past a threshold the function is
+// promoted: a copy of it goes through the optimizing pipeline and later
+// calls run the copy. A baseline activation that is still inside a long
+// running loop switches over on the next back-edge of its outermost loop
+// (on-stack replacement), since the optimized tier only adds frame slots.
+//
+// With memoization, a call to a pure function first looks its arguments up
+// in the function's cache and only runs the body on a miss.
+//
+// Parallel loops run on a WorkPool. Each participant gets a context of its
+// own that shares the globals and compiled functions of the interpreter
+// running the loop but not its tiering, and a parallel loop inside such a
+// context runs serially.
+class Interpreter {
+private:
+    enum class Flow { NEXT, BREAK, CONTINUE, RETURN, TAIL };
+    enum class Tier { BASELINE, OPTIMIZED };
+
+    struct Promotion {
+        double at_ms;
+        std::size_t calls;
+        std::size_t back_edges;
+        bool by_loop; // loop threshold rather than call threshold
+    };
+
+    struct Function {
+        std::shared_ptr<FunDecl> baseline;
+        std::shared_ptr<FunDecl> optimized;
+        // Outermost loops of the baseline body, compiled for entry mid loop
+        std::unordered_map<const Stmt*, std::shared_ptr<Stmt>> osr;
+        std::size_t calls;
+        std::size_t back_edges;
+        std::size_t osr_entries;
+        std::optional<Promotion> promotion;
+    };
+
+    struct Frame {
+        Function* fun;
+        Tier tier;
+        std::size_t base; // of the locals in stack
+        std::size_t loop_depth;
+    };
+
+    const Program& program;
+    TierOptions options;
+    Inliner inliner;
+    std::vector<Function> functions;
+    std::vector<int64_t> own_globals;
+    int64_t* globals; // own_globals, or those of the parent context
+    std::vector<int64_t> stack;
+    std::vector<Frame> frames;
+    int64_t ret; // value of the last return
+    std::size_t tail_fun; // pending tail call
+    std::size_t tail_args; // its arguments, on top of the stack
+    std::chrono::steady_clock::time_point start;
+    CallStack* sampled; // shadow stack for the profiler, if any
+    const NativeLibraries* libraries;
+    std::vector<NativeFunction> natives; // bound by run()
+    WorkPool* pool; // parallel loops run serially without one
+    std::vector<std::unique_ptr<MemoCache>> memos; // of pure functions
+    std::vector<std::string> unmemoized; // why not, per function
+
+    // Context for one participant of loop, started from the running frame
+    // with the reduction variables of loop at their identity
+    Interpreter(const Interpreter& parent, const ParLoopStmt& loop);
+
+    // Arguments are the values pushed on stack from base on
+    int64_t call(std::size_t fun, std::size_t base);
+    Flow statement(const Stmt* stmt);
+    Flow loop(const LoopStmt* loop);
+    Flow par_loop(const ParLoopStmt* loop);
+    void iterations(const ParLoopStmt* loop, int64_t begin, int64_t end);
+    int64_t expression(const Expr* expr);
+    int64_t& variable(const Slot& slot);
+    void promote(Function& fun, bool by_loop);
+    void bind();
+
+public:
+    // Extern functions are looked up in libraries, which must outlive the
+    // interpreter
+    Interpreter(const Program& program, TierOptions options,
+        const NativeLibraries* libraries = nullptr);
+
+    int64_t run(const std::string& entry);
+    // Calls fun (an index into Program::functions) with count arguments.
+    // Cheaper than run(): no lookup, and the clock of the tier stats keeps
+    // running. Globals keep their values from one call to the next.
+    int64_t invoke(std::size_t fun, const int64_t* args, std::size_t count);
+    void profile(CallStack* stack) { sampled = stack; }
+    void parallel(WorkPool* workers) { pool = workers; }
+    // Caches up to capacity results of every pure function (purity.hpp),
+    // returns how many functions get a cache. Calls made from parallel
+    // loops bypass the caches.
+    std::size_t memoize(std::size_t capacity);
+    void print_tier_stats(std::ostream& out) const;
+    void print_memo_stats(std::ostream& out) const;
+};
@@ -0,0 +1,116 @@
+#include "lang.hpp"
+#include "diagnostics.hpp"
+#include "interp.hpp"
+#include "lexer.hpp"
+#include "module.hpp"
+#include "native.hpp"
+#include "optimize.hpp"
+#include "parser.hpp"
+#include "purity.hpp"
+#include "resolve.hpp"
+#include "semantic.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+
+CompiledProgram::CompiledProgram()
+    : program { nullptr }
+    , libraries { nullptr }
+{
+}
+
+CompiledProgram::~CompiledProgram() = default;
+
+// The pipeline of main without tiering: everything is optimized here, once,
+// so contexts only ever read the tree
+shared_ptr<const CompiledProgram> CompiledProgram::compile(
+    const string& source, const CompileOptions& options, const string& name)
+{
+    Diagnostics diags { name, source };
+    shared_ptr<Program> program { nullptr };
+    try {
+        Semantic parser { TokenStream { source }, diags };
+        program = parser.parse();
+    } catch (const CompileError& e) {
+        diags.error(e);
+    }
+
+    if (diags.has_errors() || program == nullptr) {
+        std::ostringstream message {};
+        diags.print(message);
+        message << "ERROR: " << diags.count() << " error(s) in " << name;
+        throw runtime_error(message.str());
+    }
+
+    program = link({ { name, program } }); // checks the externs
+    Resolver {}.resolve(*program);
+    check_parallel_loops(*program);
+    Inliner { options.inline_budget }.run(*program);
+    if (options.tail_calls)
+        TailCalls {}.run(*program);
+    if (options.loop_opts)
+        LoopOptimizer {}.run(*program);
+
+    auto compiled { std::make_shared<CompiledProgram>() };
+    compiled->program = program;
+    compiled->libraries
+        = std::make_unique<NativeLibraries>(options.native_libs);
+    return compiled;
+}
+
+size_t CompiledProgram::function(const string& name) const
+{
+    auto found { std::find_if(program->functions.begin(),
+        program->functions.end(),
+        [&](const auto& fun) { return fun->name == name; }) };
+    if (found == program->functions.end())
+        throw runtime_error("ERROR: No function named " + name);
+    return (*found)->index;
+}
+
+size_t CompiledProgram::arity(size_t fun) const
+{
+    return program->functions.at(fun)->param_list.size();
+}
+
+Context::Context(shared_ptr<const CompiledProgram> program)
+    : program { std::move(program) }
+    , interpreter { nullptr }
+{
+    // Already optimized by compile(), and promoting would write the tree
+    TierOptions tiers { false, 0, 0, OptOptions { 0, false, false } };
+    interpreter = std::make_unique<Interpreter>(*this->program->program,
+        tiers, this->program->libraries.get());
+}
+
+Context::~Context() = default;
+
+int64_t Context::call(size_t fun, const int64_t* args, size_t count)
+{
+    if (fun >= program->program->functions.size())
+        throw runtime_error("ERROR: No function #" + std::to_string(fun));
+    return interpreter->invoke(fun, args, count);
+}
+
+void Context::call_batch(
+    size_t fun, const int64_t* args, size_t rows, int64_t* results)
+{
+    if (fun >= program->program->functions.size())
+        throw runtime_error("ERROR: No function #" + std::to_string(fun));
+
+    size_t arity { program->arity(fun) };
+    for (size_t row = 0; row < rows; ++row)
+        results[row] = interpreter->invoke(fun, args + row * arity, arity);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Embedding API, built into out/liblang.a and out/liblang.so.
+//
+//     auto program { CompiledProgram::compile(source) };
+//     Context context { program }; // one per thread
+//     int64_t sum { context.call(program->function("sum"), { 2, 3 }) };
+//
+// A CompiledProgram is never modified after compile(), so any number of
+// threads can share it. A Context holds everything a call changes (stack,
+// frames and globals) and belongs to one thread at a time; it is cheap to
+// create, but reusing it keeps calls free of allocation.
+
+struct Program; // parser.hpp
+class NativeLibraries; // native.hpp
+class Interpreter; // interp.hpp
+
+struct CompileOptions {
+    std::size_t inline_budget { 16 }; // 0 disables inlining
+    bool tail_calls { true };
+    bool loop_opts { true };
+    std::vector<std::string> native_libs {}; // searched for extern functions
+};
+
+class CompiledProgram {
+private:
+    std::shared_ptr<Program> program; // resolved and optimized
+    std::unique_ptr<NativeLibraries> libraries;
+
+    friend class Context;
+
+public:
+    // Lexes, checks, resolves and optimizes source. Throws runtime_error
+    // with the diagnostics if it does not compile; name is used in them.
+    static std::shared_ptr<const CompiledProgram> compile(
+        const std::string& source, const CompileOptions& options = {},
+        const std::string& name = "<source>");
+
+    // Index of the function called name, throws runtime_error if none
+    std::size_t function(const std::string& name) const;
+    std::size_t arity(std::size_t fun) const;
+
+    CompiledProgram();
+    ~CompiledProgram();
+};
+
+class Context {
+private:
+    std::shared_ptr<const CompiledProgram> program;
+    std::unique_ptr<Interpreter> interpreter;
+
+public:
+    explicit Context(std::shared_ptr<const CompiledProgram> program);
+    ~Context();
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    // Missing arguments are 0, as in the language. Runtime errors (division
+    // by zero, stack overflow, ...) throw runtime_error.
+    int64_t call(std::size_t fun, const int64_t* args, std::size_t count);
+    int64_t call(std::size_t fun, const std::vector<int64_t>& args)
+    {
+        return call(fun, args.data(), args.size());
+    }
+
+    // Calls fun once per row of args, rows * arity(fun) values laid out row
+    // after row, writing the results to results[0 .. rows)
+    void call_batch(std::size_t fun, const int64_t* args, std::size_t rows,
+        int64_t* results);
+};
@@ -1,31 +1,130 @@
+#include "diagnostics.hpp"
 #include "lexer.hpp"
+#include "ring.hpp"
 #include "types.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <iostream>
-#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 using std::cout;
 using std::find;
-using std::runtime_error;
 using std::size_t;
 using std::string;
+using std::vector;
+
+// Below this many bytes per thread lexing in parallel does not pay off
+static constexpr size_t min_chunk { 1 << 20 };
+// Source bytes per batch handed from the lexer thread to the parser
+static constexpr size_t pipeline_slice { 1 << 14 };
+
+struct TokenStream::Pipeline {
+    string buf;
+    SpscRing<vector<Token>, 64> ring;
+    std::atomic<bool> cancelled { false };
+    std::thread lexer;
+    bool done { false }; // FEOF received
+};
+
+void TokenBuffer::append(vector<Token> batch)
+{
+    if (batch.empty())
+        return;
+
+    starts.push_back(count);
+    count += batch.size();
+    batches.push_back(std::move(batch));
+}
+
+size_t TokenBuffer::find(size_t i) const
+{
+    auto after { std::upper_bound(starts.begin(), starts.end(), i) };
+    return static_cast<size_t>(after - starts.begin()) - 1;
+}
 
 void TokenStream::print() const
 {
-    for (auto token : tokens) {
+    fill(static_cast<size_t>(-1));
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const Token& token { tokens.at(i) };
         cout << static_cast<int>(token.token_type) << ": " << token.token_str
              << '\n';
     }
 }
 
-TokenStream::TokenStream(string buf)
-    : tokens {}
-    , current { 0 }
+// 42, 0x2a, 0b101010, 4.2, 42e-1. Digits are converted in place, the token
+// text is only kept for messages.
+static size_t number(const string& buf, size_t i, vector<Token>& tokens)
 {
-    size_t i = 0;
-    while (i < buf.length()) {
+    size_t start { i };
+    NumberValue value {};
+    std::from_chars_result result {};
+
+    if (buf[i] == '0' && (buf[i + 1] == 'x' || buf[i + 1] == 'X'
+            || buf[i + 1] == 'b' || buf[i + 1] == 'B')) {
+        int base { buf[i + 1] == 'b' || buf[i + 1] == 'B' ? 2 : 16 };
+        i += 2;
+
+        size_t digits { i };
+        while (base == 16 ? isxdigit(buf[i]) : buf[i] == '0' || buf[i] == '1')
+            ++i;
+
+        if (i == digits)
+            value.status = NumberValue::Status::MALFORMED;
+        else
+            result = std::from_chars(
+                buf.data() + digits, buf.data() + i, value.integer, base);
+    } else {
+        while (isdigit(buf[i]))
+            ++i;
+
+        if (buf[i] == '.' && isdigit(buf[i + 1])) {
+            value.floating = true;
+            for (++i; isdigit(buf[i]);)
+                ++i;
+        }
+
+        // The exponent needs digits, 2e is a number followed by a name
+        if (buf[i] == 'e' || buf[i] == 'E') {
+            size_t sign { i + 1 };
+            if (sign < buf.length() && (buf[sign] == '+' || buf[sign] == '-'))
+                ++sign;
+            if (sign < buf.length() && isdigit(buf[sign])) {
+                value.floating = true;
+                for (i = sign; isdigit(buf[i]);)
+                    ++i;
+            }
+        }
+
+        if (value.floating)
+            result = std::from_chars(
+                buf.data() + start, buf.data() + i, value.real);
+        else
+            result = std::from_chars(
+                buf.data() + start, buf.data() + i, value.integer);
+    }
+
+    if (result.ec == std::errc::result_out_of_range)
+        value.status = NumberValue::Status::OUT_OF_RANGE;
+
+    tokens.push_back(
+        { TokenType::NUMBER, buf.substr(start, i - start), start, value });
+    return i;
+}
+
+// Lexes the tokens that start in [i, end). The last one may run past end,
+// the return value is where the next token can start.
+static size_t lex(
+    const string& buf, size_t i, size_t end, vector<Token>& tokens)
+{
+    while (i < end) {
+        size_t start = i;
         if (isspace(buf[i])) {
             i++;
             continue;
@@ -39,6 +138,8 @@ TokenStream::TokenStream(string buf)
             TokenType tok_type;
             if (tok_str == "extern")
                 tok_type = TokenType::EXTERN;
+            else if (tok_str == "import")
+                tok_type = TokenType::IMPORT;
             else if (tok_str == "static")
                 tok_type = TokenType::STATIC;
             else if (tok_str == "auto")
@@ -53,21 +154,23 @@ TokenStream::TokenStream(string buf)
                 tok_type = TokenType::ELSE;
             else if (tok_str == "loop")
                 tok_type = TokenType::LOOP;
+            else if (tok_str == "parallel")
+                tok_type = TokenType::PARALLEL;
+            else if (tok_str == "reduce")
+                tok_type = TokenType::REDUCE;
             else if (find(base_types.begin(), base_types.end(), tok_str)
                 != base_types.end())
                 tok_type = TokenType::BASE_TYPE;
             else
                 tok_type = TokenType::IDENT;
 
-            tokens.push_back({ tok_type, tok_str });
+            tokens.push_back({ tok_type, tok_str, start });
             continue;
         }
 
         else if (isdigit(buf[i])) {
-            string tok_str;
-            while (isdigit(buf[i]))
-                tok_str += buf[i++];
-            tokens.push_back({ TokenType::NUMBER, tok_str });
+            i = number(buf, i, tokens);
+            continue;
         }
 
         else if (buf[i] == '`') {
@@ -80,121 +183,279 @@ TokenStream::TokenStream(string buf)
 
             if (i < buf.length()) {
                 tok_str += buf[i++];
-                tokens.push_back({ TokenType::STRING, tok_str });
+                tokens.push_back({ TokenType::STRING, tok_str, start });
             } else {
-                tokens.push_back({ TokenType::ERR, tok_str });
-                break;
+                // Nothing after an unterminated string is lexed
+                tokens.push_back({ TokenType::ERR, tok_str, start });
+                return buf.length();
             }
         } else
             switch (buf[i]) {
             case '{': {
-                tokens.push_back({ TokenType::LBRACE, "{" });
+                tokens.push_back({ TokenType::LBRACE, "{", start });
                 ++i;
                 break;
             }
             case '}': {
-                tokens.push_back({ TokenType::RBRACE, "}" });
+                tokens.push_back({ TokenType::RBRACE, "}", start });
                 ++i;
                 break;
             }
             case '(': {
-                tokens.push_back({ TokenType::LPAREN, "(" });
+                tokens.push_back({ TokenType::LPAREN, "(", start });
                 ++i;
                 break;
             }
             case ')': {
-                tokens.push_back({ TokenType::RPAREN, ")" });
+                tokens.push_back({ TokenType::RPAREN, ")", start });
                 ++i;
                 break;
             }
             case ';': {
-                tokens.push_back({ TokenType::SCOLON, ";" });
+                tokens.push_back({ TokenType::SCOLON, ";", start });
+                ++i;
+                break;
+            }
+            case ',': {
+                tokens.push_back({ TokenType::COMMA, ",", start });
                 ++i;
                 break;
             }
             case '=': {
                 if (buf[i + 1] == '=') {
-                    tokens.push_back({ TokenType::DEQ, "==" });
+                    tokens.push_back({ TokenType::DEQ, "==", start });
                     i += 2;
                     break;
                 }
-                tokens.push_back({ TokenType::EQ, "=" });
+                tokens.push_back({ TokenType::EQ, "=", start });
                 ++i;
                 break;
             }
             case '>': {
-                tokens.push_back({ TokenType::GT, ">" });
+                if (buf[i + 1] == '=') {
+                    tokens.push_back({ TokenType::GTE, ">=", start });
+                    i += 2;
+                    break;
+                }
+                tokens.push_back({ TokenType::GT, ">", start });
                 ++i;
                 break;
             }
             case '<': {
-                tokens.push_back({ TokenType::LT, "<" });
+                if (buf[i + 1] == '=') {
+                    tokens.push_back({ TokenType::LTE, "<=", start });
+                    i += 2;
+                    break;
+                }
+                tokens.push_back({ TokenType::LT, "<", start });
                 ++i;
                 break;
             }
             case '+': {
-                tokens.push_back({ TokenType::ADD, "+" });
+                tokens.push_back({ TokenType::ADD, "+", start });
                 ++i;
                 break;
             }
             case '-': {
-                tokens.push_back({ TokenType::SUB, "-" });
+                tokens.push_back({ TokenType::SUB, "-", start });
                 ++i;
                 break;
             }
             case '*': {
-                tokens.push_back({ TokenType::MUL, "*" });
+                tokens.push_back({ TokenType::MUL, "*", start });
                 ++i;
                 break;
             }
             case '/': {
-                tokens.push_back({ TokenType::DIV, "/" });
+                tokens.push_back({ TokenType::DIV, "/", start });
                 ++i;
                 break;
             }
             case '%': {
-                tokens.push_back({ TokenType::MOD, "%" });
+                tokens.push_back({ TokenType::MOD, "%", start });
                 ++i;
                 break;
             }
             case '~': {
                 if (buf[i + 1] == '=') {
-                    tokens.push_back({ TokenType::NEQ, "~=" });
+                    tokens.push_back({ TokenType::NEQ, "~=", start });
                     i += 2;
                     break;
                 }
-                tokens.push_back({ TokenType::NOT, "~" });
+                tokens.push_back({ TokenType::NOT, "~", start });
                 ++i;
                 break;
             }
             default: {
-                tokens.push_back({ TokenType::ERR, string { buf[i] } });
+                tokens.push_back({ TokenType::ERR, string { buf[i] }, start });
                 ++i;
                 break;
             }
             }
     }
-    tokens.push_back({ TokenType::FEOF, "EOF" });
+    return i;
+}
+
+TokenStream::TokenStream(string buf, size_t threads)
+    : tokens {}
+    , current { 0 }
+    , pipeline { nullptr }
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, buf.length() / min_chunk + 1);
+
+    if (threads == 1) {
+        vector<Token> all {};
+        lex(buf, 0, buf.length(), all);
+        all.push_back({ TokenType::FEOF, "EOF", buf.length() });
+        tokens.append(std::move(all));
+        return;
+    }
+
+    // Chunks end at whitespace, which outside of a string always separates
+    // two tokens. Each chunk is lexed as if it did not start inside a string.
+    vector<size_t> bounds { 0 };
+    for (size_t k = 1; k < threads; ++k) {
+        size_t at { std::max(bounds.back(), buf.length() * k / threads) };
+        while (at < buf.length() && !isspace(buf[at]))
+            ++at;
+        if (at < buf.length())
+            bounds.push_back(at);
+    }
+    bounds.push_back(buf.length());
+
+    size_t chunks { bounds.size() - 1 };
+    vector<vector<Token>> lexed(chunks);
+    vector<size_t> resume(chunks);
+    vector<std::thread> workers {};
+
+    for (size_t k = 1; k < chunks; ++k)
+        workers.emplace_back([&, k] {
+            resume[k] = lex(buf, bounds[k], bounds[k + 1], lexed[k]);
+        });
+    resume[0] = lex(buf, bounds[0], bounds[1], lexed[0]);
+    for (auto& worker : workers)
+        worker.join();
+
+    // A chunk guessed right if the previous one stopped exactly at its
+    // start. Otherwise a string (or an unterminated one) ran into it and
+    // the rest of it is lexed again from where that token ended.
+    size_t next { 0 };
+    for (size_t k = 0; k < chunks; ++k) {
+        if (next == bounds[k]) {
+            tokens.append(std::move(lexed[k]));
+            next = resume[k];
+        } else if (next < bounds[k + 1]) {
+            vector<Token> relexed {};
+            next = lex(buf, next, bounds[k + 1], relexed);
+            tokens.append(std::move(relexed));
+        }
+    }
+    tokens.append({ { TokenType::FEOF, "EOF", buf.length() } });
+}
+
+TokenStream::TokenStream()
+    : tokens {}
+    , current { 0 }
+    , pipeline { nullptr }
+{
+}
+
+TokenStream TokenStream::pipelined(string buf)
+{
+    TokenStream stream {};
+    stream.pipeline = std::make_unique<Pipeline>();
+    stream.pipeline->buf = std::move(buf);
+
+    Pipeline& state { *stream.pipeline };
+    state.lexer = std::thread { [&state] {
+        const string& buf { state.buf };
+        size_t i { 0 };
+
+        while (true) {
+            vector<Token> batch {};
+            i = lex(buf, i, std::min(i + pipeline_slice, buf.length()), batch);
+
+            bool last { i >= buf.length() };
+            if (last)
+                batch.push_back({ TokenType::FEOF, "EOF", buf.length() });
+            if (batch.empty())
+                continue;
+
+            while (!state.ring.push(batch)) {
+                if (state.cancelled.load(std::memory_order_relaxed))
+                    return;
+                std::this_thread::yield();
+            }
+            if (last)
+                return;
+        }
+    } };
+
+    return stream;
+}
+
+void TokenStream::fill(size_t i) const
+{
+    if (i < tokens.size() || pipeline == nullptr)
+        return;
+
+    while (i >= tokens.size() && !pipeline->done) {
+        vector<Token> batch {};
+        if (!pipeline->ring.pop(batch)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        pipeline->done = batch.back().token_type == TokenType::FEOF;
+        tokens.append(std::move(batch));
+    }
+
+    if (pipeline->done) {
+        pipeline->lexer.join();
+        pipeline.reset();
+    }
+}
+
+TokenStream::TokenStream(TokenStream&& other) noexcept = default;
+
+TokenStream::~TokenStream()
+{
+    if (pipeline != nullptr) {
+        pipeline->cancelled.store(true);
+        pipeline->lexer.join();
+    }
 }
 
 const Token& TokenStream::peek(size_t n) const
 {
+    fill(current + n);
     return tokens.at(current + n);
 }
-const Token& TokenStream::advance(size_t n) { return tokens.at(current += n); }
 
-inline const Token& TokenStream::cur() const { return peek(0); }
+const Token& TokenStream::advance(size_t n)
+{
+    fill(current += n);
+    return tokens.at(current);
+}
+
+const Token& TokenStream::cur() const { return peek(0); }
 
 bool TokenStream::match(TokenType type) const
 {
-    return tokens.at(current).token_type == type;
+    return peek(0).token_type == type;
 }
 
-const Token& TokenStream::expect(TokenType type, string msg)
+const Token& TokenStream::expect(TokenType type, const char* what)
 {
     if (match(type))
         return advance(0);
-    throw runtime_error { "ERROR: " + msg + " at " + cur().token_str };
+    throw CompileError { cur().pos,
+        string { "Expected " } + what + " but got " + cur().token_str
+            + " instead!" };
 }
 
+size_t TokenStream::position() const { return current; }
+
 bool TokenStream::is_end() const { return cur().token_type == TokenType::FEOF; }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -13,6 +16,7 @@ enum class TokenType {
     SCOLON,
     COMMA,
     EXTERN,
+    IMPORT,
     AUTO,
     BASE_TYPE, // Defined in types.hpp
     FUN,
@@ -36,27 +40,91 @@ enum class TokenType {
     IF,
     ELSE,
     LOOP,
+    PARALLEL,
+    REDUCE,
     ERR,
     FEOF,
 };
 
+// Value of a NUMBER token, converted once by the lexer. A leading - is a
+// separate token, so integers are kept as their 64 bit magnitude.
+struct NumberValue {
+    enum class Status {
+        OK,
+        OUT_OF_RANGE, // more than 64 bits, or beyond what a double holds
+        MALFORMED, // 0x or 0b without digits
+    };
+
+    uint64_t integer { 0 };
+    double real { 0 };
+    bool floating { false };
+    Status status { Status::OK };
+};
+
 struct Token {
     TokenType token_type;
     std::string token_str;
+    std::size_t pos; // byte offset into the source
+    NumberValue number {};
+};
+
+// Tokens as the batches they were lexed in. A batch is never touched after
+// it is appended, so references to tokens stay valid while more arrive.
+class TokenBuffer {
+private:
+    std::vector<std::vector<Token>> batches;
+    std::vector<std::size_t> starts; // index of the first token of a batch
+    std::size_t count { 0 };
+    mutable std::size_t last { 0 }; // batch of the previous lookup
+
+public:
+    void append(std::vector<Token> batch);
+    std::size_t size() const { return count; }
+
+    const Token& at(std::size_t i) const
+    {
+        if (i >= count)
+            throw std::out_of_range("token index out of range");
+        // Lookups mostly stay in the batch of the previous one
+        if (i - starts[last] >= batches[last].size())
+            last = find(i);
+        return batches[last][i - starts[last]];
+    }
+
+    std::size_t find(std::size_t i) const;
 };
 
 class TokenStream {
 private:
-    std::vector<Token> tokens;
+    struct Pipeline;
+
+    mutable TokenBuffer tokens;
     std::size_t current;
+    // Lexer thread still producing tokens, see pipelined()
+    mutable std::unique_ptr<Pipeline> pipeline;
+
+    TokenStream();
+    // Waits for the lexer thread until token i is there or it is done
+    void fill(std::size_t i) const;
 
 public:
     void print() const;
-    TokenStream(std::string buf);
+    // Large buffers are split into chunks lexed on up to threads threads
+    // (0: one per core), the tokens are the same as a serial run
+    TokenStream(std::string buf, std::size_t threads = 0);
+    // Lexes on a separate thread that hands batches of tokens over through
+    // a lock-free ring, so parsing starts while the lexer is still running
+    static TokenStream pipelined(std::string buf);
+
+    TokenStream(TokenStream&& other) noexcept;
+    ~TokenStream();
+
     const Token& peek(std::size_t n) const;
     const Token& advance(std::size_t n);
     const Token& cur() const;
     bool match(TokenType type) const;
-    const Token& expect(TokenType type, std::string msg);
+    // Throws "Expected <what> but got ..." only when the match fails
+    const Token& expect(TokenType type, const char* what);
+    std::size_t position() const;
     bool is_end() const;
 };
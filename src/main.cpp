@@ -1,61 +1,372 @@
 #include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <cstddef>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "diagnostics.hpp"
+#include "dump.hpp"
+#include "emit_c.hpp"
+#include "interp.hpp"
 #include "lexer.hpp"
+#include "module.hpp"
+#include "native.hpp"
+#include "optimize.hpp"
 #include "parser.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "purity.hpp"
+#include "resolve.hpp"
 #include "semantic.hpp"
 
 using std::cerr;
 using std::cout;
 using std::ifstream;
+using std::ofstream;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
 using std::stringstream;
+using std::vector;
 
 int main(int argc, const char* argv[])
 {
-    if (argc < 2) {
-        cerr << "ERROR: No file provided!\n"
-             << "USAGE: " << argv[0] << " example.a" << '\n';
+    bool syntax_only = false;
+    bool dump_ast = false;
+    bool run = false;
+    bool tier_stats = false;
+    bool profile = false;
+    size_t profile_interval = 1000; // microseconds
+    string profile_out { "profile.folded" };
+    OptOptions opts { 16, true, true };
+    TierOptions tiers { true, 1000, 10000, opts };
+    bool emit_interface = false;
+    bool pipeline = false;
+    bool keep_dead = false;
+    size_t threads = 0; // for parallel loops, 0 is one per core
+    bool memoize = false;
+    size_t memo_size = 4096; // results per function
+    string emit_c {}; // C file to write, none if empty
+    string cc_out {}; // what to compile emit_c into, if anything
+    vector<string> native_libs {};
+    vector<const char*> paths {};
+
+    // --name=N, false if arg is not that option
+    auto numeric = [](const string& arg, const string& name, size_t& value) {
+        if (arg.rfind(name + "=", 0) != 0)
+            return false;
+
+        try {
+            value = std::stoul(arg.substr(name.length() + 1));
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("ERROR: Invalid value in " + arg);
+        }
+        return true;
+    };
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg { argv[i] };
+            if (arg == "--syntax-only")
+                syntax_only = true;
+            else if (arg == "--dump-ast")
+                dump_ast = true;
+            else if (arg == "--no-tail-calls")
+                opts.tail_calls = false;
+            else if (arg == "--no-loop-opts")
+                opts.loop_opts = false;
+            else if (arg == "--run")
+                run = true;
+            else if (arg == "--no-tiering")
+                tiers.enabled = false;
+            else if (arg == "--tier-stats")
+                tier_stats = true;
+            else if (arg == "--profile")
+                run = profile = true;
+            else if (arg.rfind("--native-lib=", 0) == 0)
+                native_libs.push_back(
+                    arg.substr(string { "--native-lib=" }.length()));
+            else if (arg.rfind("--emit-c=", 0) == 0)
+                emit_c = arg.substr(string { "--emit-c=" }.length());
+            else if (arg.rfind("--cc=", 0) == 0)
+                cc_out = arg.substr(string { "--cc=" }.length());
+            else if (arg.rfind("--profile-out=", 0) == 0)
+                profile_out = arg.substr(string { "--profile-out=" }.length());
+            else if (numeric(arg, "--inline-budget", opts.inline_budget)
+                || numeric(arg, "--tier-calls", tiers.call_threshold)
+                || numeric(arg, "--tier-loops", tiers.loop_threshold)
+                || numeric(arg, "--profile-interval", profile_interval)
+                || numeric(arg, "--threads", threads)
+                || numeric(arg, "--memo-size", memo_size))
+                continue;
+            else if (arg == "--emit-interface")
+                emit_interface = true;
+            else if (arg == "--pipeline")
+                pipeline = true;
+            else if (arg == "--keep-dead")
+                keep_dead = true;
+            else if (arg == "--memoize")
+                memoize = true;
+            else
+                paths.push_back(argv[i]);
+        }
+    } catch (const std::invalid_argument& e) {
+        cerr << e.what() << '\n';
         return EXIT_FAILURE;
     }
+    tiers.opts = opts;
 
-    cout << "INFO: File " << argv[1] << '\n';
+    if (!cc_out.empty() && emit_c.empty()) {
+        cerr << "ERROR: --cc needs the C file to compile, see --emit-c\n";
+        return EXIT_FAILURE;
+    }
 
-    ifstream input;
-    input.exceptions(ifstream::badbit);
+    if (profile_interval == 0) {
+        cerr << "ERROR: --profile-interval must be at least 1 microsecond\n";
+        return EXIT_FAILURE;
+    }
 
-    try {
-        input.open(argv[1]);
-        if (!input.good())
-            throw ifstream::failure("ERROR: No file present!");
-
-        cout << "INFO: Opened " << argv[1] << " successfully!\n";
-    } catch (const ifstream::failure& e) {
-        cerr << "ERROR: "
-             << "Could not open file " << argv[1] << '\n'
-             << "ERROR: " << e.what() << '\n';
+    if (paths.empty()) {
+        cerr << "ERROR: No file provided!\n"
+             << "USAGE: " << argv[0]
+             << " [--syntax-only] [--dump-ast] [--inline-budget=N]"
+                " [--no-tail-calls] [--no-loop-opts] [--run] [--no-tiering]"
+                " [--tier-calls=N] [--tier-loops=N] [--tier-stats]"
+                " [--profile] [--profile-interval=US] [--profile-out=FILE]"
+                " [--emit-interface] [--pipeline] [--native-lib=FILE]"
+                " [--keep-dead] [--threads=N] [--memoize] [--memo-size=N]"
+                " [--emit-c=FILE.c] [--cc=OUTPUT[.so]]"
+                " example.a [module.a ...]"
+             << '\n';
         return EXIT_FAILURE;
     }
 
-    stringstream input_buf {};
-    input_buf << input.rdbuf();
-    input.close();
+    // Every file is compiled on its own against the interfaces of the
+    // modules it imports, then the modules are linked into one program
+    ModuleLoader loader {};
+    vector<Module> modules {};
+    bool failed = false;
 
-    TokenStream token_stream { input_buf.str() };
-    // token_stream.print();
+    for (const char* path : paths) {
+        cout << "INFO: File " << path << '\n';
+
+        ifstream input;
+        input.exceptions(ifstream::badbit);
+
+        try {
+            input.open(path);
+            if (!input.good())
+                throw ifstream::failure("ERROR: No file present!");
+
+            cout << "INFO: Opened " << path << " successfully!\n";
+        } catch (const ifstream::failure& e) {
+            cerr << "ERROR: "
+                 << "Could not open file " << path << '\n'
+                 << "ERROR: " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+
+        stringstream input_buf {};
+        input_buf << input.rdbuf();
+        input.close();
+
+        string source { input_buf.str() };
+        Diagnostics diags { path, source };
+        // Pipelined, the parser consumes tokens while the lexer produces them
+        TokenStream token_stream { pipeline ? TokenStream::pipelined(source)
+                                            : TokenStream { source } };
+        // token_stream.print();
+
+        std::filesystem::path file { path };
+        loader.search(file.parent_path().string());
+        shared_ptr<Program> program { nullptr };
+
+        try {
+            if (syntax_only) {
+                SyntaxChecker parser { std::move(token_stream), diags };
+                parser.parse();
+            } else {
+                Semantic parser { std::move(token_stream), diags, &loader };
+                program = parser.parse();
+            }
+        } catch (const CompileError& e) {
+            diags.error(e);
+        }
+
+        if (diags.has_errors()) {
+            diags.print(cerr);
+            cerr << "ERROR: " << diags.count() << " error(s) in " << path
+                 << '\n';
+            failed = true;
+            continue;
+        }
+
+        if (program == nullptr)
+            continue;
+
+        // Later files of this run may import this one
+        Interface interface { Interface::of(file.stem().string(), *program) };
+        if (emit_interface) {
+            file.replace_extension(".ai");
+            ofstream out { file, std::ios::binary };
+            interface.write(out);
+            if (!out.good()) {
+                cerr << "ERROR: Could not write " << file.string() << '\n';
+                return EXIT_FAILURE;
+            }
+            cout << "INFO: Wrote interface " << file.string() << '\n';
+        }
+        loader.add(std::move(interface));
+        modules.push_back({ file.stem().string(), program });
+    }
+
+    if (failed)
+        return EXIT_FAILURE;
+    if (modules.empty())
+        return 0;
+
+    shared_ptr<Program> program { nullptr };
 
     try {
-        Semantic parser { token_stream };
-        auto program = parser.parse();
+        // Without every imported module there is nothing to link yet
+        if (auto missing = unlinked(modules); !missing.empty()) {
+            string names {};
+            for (const auto& name : missing)
+                names += (names.empty() ? "" : ", ") + name;
+
+            if (run)
+                throw std::runtime_error(
+                    "ERROR: Cannot run without the imported module(s) "
+                    + names);
+            cout << "INFO: Not linking, imported module(s) " << names
+                 << " not given\n";
+
+            if (dump_ast)
+                for (const auto& module : modules)
+                    AstDumper { cout }.dump(*module.program);
+            return 0;
+        }
+
+        program = link(modules);
+        Resolver {}.resolve(*program);
+        check_parallel_loops(*program);
+
+        if (!keep_dead) {
+            auto removed { DeadCode { "main" }.run(*program) };
+            cout << "INFO: Removed " << removed.functions
+                 << " unreachable function(s), " << removed.globals
+                 << " unused global(s), " << removed.natives
+                 << " unused extern function(s)\n";
+        }
+
+        // When tiering, functions are optimized as they get hot
+        if (!(run && tiers.enabled)) {
+            size_t inlined { Inliner { opts.inline_budget }.run(*program) };
+            cout << "INFO: Inlined " << inlined << " call(s)\n";
+
+            if (opts.tail_calls) {
+                size_t jumps { TailCalls {}.run(*program) };
+                cout << "INFO: Turned " << jumps
+                     << " tail call(s) into jumps\n";
+            }
+
+            if (opts.loop_opts) {
+                auto stats { LoopOptimizer {}.run(*program) };
+                cout << "INFO: Hoisted " << stats.hoisted
+                     << " loop invariant(s), strength reduced "
+                     << stats.reduced << " multiplication(s), rotated "
+                     << stats.rotated << " loop(s)\n";
+            }
+        }
     } catch (const std::runtime_error& e) {
         cerr << e.what() << '\n';
         return EXIT_FAILURE;
     }
 
+    if (dump_ast && program != nullptr)
+        AstDumper { cout }.dump(*program);
+
+    if (!emit_c.empty() && program != nullptr) {
+        ofstream out { emit_c };
+        try {
+            CEmitter { out }.emit(*program);
+        } catch (const std::runtime_error& e) {
+            cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+        out.close();
+        if (!out.good()) {
+            cerr << "ERROR: Could not write " << emit_c << '\n';
+            return EXIT_FAILURE;
+        }
+        cout << "INFO: Wrote C to " << emit_c << '\n';
+
+        if (!cc_out.empty()) {
+            if (!compile_c(emit_c, cc_out, native_libs, cout)) {
+                cerr << "ERROR: Could not compile " << emit_c << '\n';
+                return EXIT_FAILURE;
+            }
+            cout << "INFO: Compiled " << cc_out << '\n';
+        }
+    }
+
+    if (run && program != nullptr) {
+        std::unique_ptr<NativeLibraries> libraries { nullptr };
+        try {
+            libraries = std::make_unique<NativeLibraries>(native_libs);
+        } catch (const std::runtime_error& e) {
+            cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+
+        Interpreter interpreter { *program, tiers, libraries.get() };
+        WorkPool pool { threads };
+        interpreter.parallel(&pool);
+        if (memoize)
+            cout << "INFO: Memoizing " << interpreter.memoize(memo_size)
+                 << " pure function(s)\n";
+        CallStack call_stack { program->functions.size(), max_call_depth };
+        Profiler profiler { *program, call_stack,
+            std::chrono::microseconds(profile_interval) };
+
+        if (profile) {
+            interpreter.profile(&call_stack);
+            profiler.start();
+        }
+
+        try {
+            int64_t result { interpreter.run("main") };
+            cout << "INFO: main returned " << result << '\n';
+        } catch (const std::runtime_error& e) {
+            cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+
+        if (tier_stats)
+            interpreter.print_tier_stats(cout);
+        if (memoize)
+            interpreter.print_memo_stats(cout);
+
+        if (profile) {
+            profiler.stop();
+            profiler.report(cout);
+
+            ofstream folded { profile_out };
+            profiler.write_folded(folded);
+            if (!folded.good()) {
+                cerr << "ERROR: Could not write " << profile_out << '\n';
+                return EXIT_FAILURE;
+            }
+            cout << "INFO: Wrote folded stacks to " << profile_out << '\n';
+        }
+    }
+
     return 0;
 }
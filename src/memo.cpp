@@ -0,0 +1,67 @@
+#include "memo.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+using std::size_t;
+
+MemoCache::MemoCache(size_t arity, size_t capacity)
+    : arity { arity }
+    , mask { 0 }
+    , keys {}
+    , values {}
+    , used {}
+    , hits { 0 }
+    , misses { 0 }
+    , evictions { 0 }
+{
+    size_t slots { 1 };
+    while (slots < capacity)
+        slots <<= 1;
+    mask = slots - 1;
+
+    keys.assign(slots * arity, 0);
+    values.assign(slots, 0);
+    used.assign(slots, false);
+}
+
+size_t MemoCache::slot(const int64_t* args) const
+{
+    uint64_t hash { 0x9e3779b97f4a7c15 };
+    for (size_t i = 0; i < arity; ++i) {
+        hash ^= static_cast<uint64_t>(args[i]);
+        hash *= 0xff51afd7ed558ccd;
+        hash ^= hash >> 32;
+    }
+    return hash & mask;
+}
+
+bool MemoCache::find(const int64_t* args, int64_t& value)
+{
+    size_t i { slot(args) };
+    if (used[i] && std::equal(args, args + arity, keys.data() + i * arity)) {
+        value = values[i];
+        ++hits;
+        return true;
+    }
+
+    ++misses;
+    return false;
+}
+
+void MemoCache::insert(const int64_t* args, int64_t value)
+{
+    size_t i { slot(args) };
+    if (used[i] && !std::equal(args, args + arity, keys.data() + i * arity))
+        ++evictions;
+
+    std::copy(args, args + arity, keys.data() + i * arity);
+    values[i] = value;
+    used[i] = true;
+}
+
+size_t MemoCache::size() const
+{
+    return std::count(used.begin(), used.end(), true);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Calls with more arguments are not worth hashing
+inline constexpr std::size_t max_memo_args { 8 };
+
+// Bounded cache of the results of one pure function, keyed by its argument
+// values. Direct mapped: a new result replaces whatever was in its slot, so
+// lookups and inserts cost one hash and no allocation.
+class MemoCache {
+private:
+    std::size_t arity;
+    std::size_t mask; // slots - 1, slots are a power of two
+    std::vector<int64_t> keys; // arity values per slot
+    std::vector<int64_t> values;
+    std::vector<bool> used;
+
+    std::size_t slot(const int64_t* args) const;
+
+public:
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t evictions;
+
+    // capacity is rounded up to a power of two
+    MemoCache(std::size_t arity, std::size_t capacity);
+
+    bool find(const int64_t* args, int64_t& value);
+    void insert(const int64_t* args, int64_t value);
+    std::size_t size() const; // slots in use
+};
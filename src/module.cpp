@@ -0,0 +1,278 @@
+#include "module.hpp"
+#include "parser.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::make_shared;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+// "lai" and a format version
+static constexpr char magic[4] { 'l', 'a', 'i', 1 };
+
+// Integers are little endian u32, strings are length prefixed and types are
+// an index into base_types
+static void put_u32(std::ostream& out, size_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static void put_string(std::ostream& out, const string& str)
+{
+    put_u32(out, str.length());
+    out.write(str.data(), static_cast<std::streamsize>(str.length()));
+}
+
+static void put_type(std::ostream& out, const string& type)
+{
+    auto found { std::find(base_types.begin(), base_types.end(), type) };
+    out.put(static_cast<char>(found - base_types.begin()));
+}
+
+static size_t get_u32(std::istream& in)
+{
+    size_t value { 0 };
+    for (int i = 0; i < 4; ++i) {
+        int byte { in.get() };
+        if (byte == std::char_traits<char>::eof())
+            throw runtime_error("truncated module interface");
+        value |= static_cast<size_t>(byte) << (8 * i);
+    }
+    return value;
+}
+
+// Read in chunks, so a corrupt length runs into the end of the file instead
+// of allocating up to 4 GB first
+static string get_string(std::istream& in)
+{
+    size_t length { get_u32(in) };
+    string str {};
+    char chunk[4096];
+    while (str.length() < length) {
+        size_t count { std::min(length - str.length(), sizeof chunk) };
+        in.read(chunk, static_cast<std::streamsize>(count));
+        if (!in)
+            throw runtime_error("truncated module interface");
+        str.append(chunk, count);
+    }
+    return str;
+}
+
+static string get_type(std::istream& in)
+{
+    int index { in.get() };
+    if (index == std::char_traits<char>::eof()
+        || static_cast<size_t>(index) >= base_types.size())
+        throw runtime_error("bad type in module interface");
+    return base_types[index];
+}
+
+Interface Interface::of(const string& module, const Program& program)
+{
+    Interface interface { module, {}, {} };
+
+    for (auto decl : program.decls) {
+        if (auto fun = dynamic_pointer_cast<FunDecl>(decl); fun != nullptr)
+            interface.functions.push_back(
+                { fun->name, fun->type, fun->param_list.size() });
+        else if (auto var = dynamic_pointer_cast<VarDecl>(decl);
+            var != nullptr && var->var_type == TokenType::AUTO)
+            interface.globals.push_back({ var->ident, var->type });
+    }
+
+    return interface;
+}
+
+void Interface::write(std::ostream& out) const
+{
+    out.write(magic, sizeof magic);
+    put_string(out, module);
+
+    put_u32(out, functions.size());
+    for (const auto& fun : functions) {
+        put_string(out, fun.name);
+        put_type(out, fun.type);
+        put_u32(out, fun.params);
+    }
+
+    put_u32(out, globals.size());
+    for (const auto& global : globals) {
+        put_string(out, global.name);
+        put_type(out, global.type);
+    }
+}
+
+Interface Interface::read(std::istream& in)
+{
+    char header[sizeof magic] {};
+    in.read(header, sizeof header);
+    if (!in || !std::equal(header, header + sizeof header, magic))
+        throw runtime_error("not a module interface (or an older version)");
+
+    Interface interface { get_string(in), {}, {} };
+
+    for (size_t n = get_u32(in); n > 0; --n) {
+        string name { get_string(in) };
+        string type { get_type(in) };
+        interface.functions.push_back({ name, type, get_u32(in) });
+    }
+
+    for (size_t n = get_u32(in); n > 0; --n) {
+        string name { get_string(in) };
+        interface.globals.push_back({ name, get_type(in) });
+    }
+
+    return interface;
+}
+
+void ModuleLoader::search(const string& dir)
+{
+    if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end())
+        dirs.push_back(dir);
+}
+
+void ModuleLoader::add(Interface interface)
+{
+    string name { interface.module };
+    loaded[name] = make_shared<const Interface>(std::move(interface));
+}
+
+shared_ptr<const Interface> ModuleLoader::load(const string& name)
+{
+    if (auto search = loaded.find(name); search != loaded.end())
+        return search->second;
+
+    for (const auto& dir : dirs) {
+        std::filesystem::path path { std::filesystem::path { dir }
+            / (name + ".ai") };
+        std::ifstream in { path, std::ios::binary };
+        if (!in.is_open())
+            continue;
+
+        try {
+            auto interface { make_shared<const Interface>(
+                Interface::read(in)) };
+            loaded[name] = interface;
+            return interface;
+        } catch (const runtime_error& e) {
+            throw runtime_error(path.string() + ": " + e.what());
+        }
+    }
+
+    return nullptr;
+}
+
+vector<string> unlinked(const vector<Module>& modules)
+{
+    std::unordered_set<string> names {};
+    for (const auto& module : modules)
+        names.insert(module.name);
+
+    vector<string> missing {};
+    for (const auto& module : modules)
+        for (auto decl : module.program->decls)
+            if (auto import = dynamic_pointer_cast<ImportDecl>(decl);
+                import != nullptr && !names.count(import->module)
+                && std::find(missing.begin(), missing.end(), import->module)
+                    == missing.end())
+                missing.push_back(import->module);
+
+    return missing;
+}
+
+shared_ptr<Program> link(const vector<Module>& modules)
+{
+    struct Definition {
+        shared_ptr<Decl> decl;
+        const string* module;
+    };
+    std::unordered_map<string, Definition> defined {};
+
+    for (const auto& module : modules) {
+        for (auto decl : module.program->decls) {
+            string name {};
+            if (auto fun = dynamic_pointer_cast<FunDecl>(decl); fun != nullptr)
+                name = fun->name;
+            else if (auto var = dynamic_pointer_cast<VarDecl>(decl);
+                var != nullptr && var->var_type == TokenType::AUTO)
+                name = var->ident;
+            else
+                continue;
+
+            auto [it, inserted] { defined.insert(
+                { name, { decl, &module.name } }) };
+            if (!inserted)
+                throw runtime_error("ERROR: " + name + " is defined in both "
+                    + *it->second.module + " and " + module.name);
+        }
+    }
+
+    vector<shared_ptr<Decl>> decls {};
+
+    for (const auto& module : modules) {
+        for (auto decl : module.program->decls) {
+            if (auto import = dynamic_pointer_cast<ImportDecl>(decl);
+                import != nullptr) {
+                const Interface& interface { *import->interface };
+
+                for (const auto& fun : interface.functions) {
+                    auto search { defined.find(fun.name) };
+                    auto def { search == defined.end()
+                            ? nullptr
+                            : dynamic_pointer_cast<FunDecl>(search->second.decl) };
+                    if (def == nullptr)
+                        throw runtime_error("ERROR: " + module.name
+                            + " imports " + fun.name + " from "
+                            + import->module + " but no module defines it");
+                    if (def->type != fun.type
+                        || def->param_list.size() != fun.params)
+                        throw runtime_error("ERROR: " + module.name
+                            + " was compiled against a stale interface of "
+                            + import->module + " (" + fun.name
+                            + " has changed)");
+                }
+
+                for (const auto& global : interface.globals) {
+                    auto search { defined.find(global.name) };
+                    auto def { search == defined.end()
+                            ? nullptr
+                            : dynamic_pointer_cast<VarDecl>(search->second.decl) };
+                    if (def == nullptr || def->type != global.type)
+                        throw runtime_error("ERROR: " + module.name
+                            + " was compiled against a stale interface of "
+                            + import->module + " (" + global.name
+                            + " has changed)");
+                }
+                continue;
+            }
+
+            // Storage of an extern global lives in the defining module
+            if (auto var = dynamic_pointer_cast<VarDecl>(decl); var != nullptr
+                && var->var_type == TokenType::EXTERN
+                && defined.count(var->ident))
+                continue;
+
+            decls.push_back(decl);
+        }
+    }
+
+    return make_shared<Program>(decls);
+}
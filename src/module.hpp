@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.hpp"
+
+// What a module exports to the modules importing it: the signatures of its
+// functions and its (non extern) globals. Stored next to the source as a
+// small binary .ai file so importers never have to parse the source again.
+struct Interface {
+    struct Function {
+        std::string name;
+        std::string type;
+        std::size_t params;
+    };
+
+    struct Global {
+        std::string name;
+        std::string type;
+    };
+
+    std::string module;
+    std::vector<Function> functions;
+    std::vector<Global> globals;
+
+    static Interface of(const std::string& module, const Program& program);
+
+    // Throws runtime_error if the data is not a valid interface
+    static Interface read(std::istream& in);
+    void write(std::ostream& out) const;
+};
+
+// Finds the interface named by an import: modules compiled earlier in the
+// same run first, then <dir>/<name>.ai in each search directory
+class ModuleLoader {
+private:
+    std::vector<std::string> dirs;
+    std::unordered_map<std::string, std::shared_ptr<const Interface>> loaded;
+
+public:
+    void search(const std::string& dir);
+    void add(Interface interface);
+    // nullptr if there is no such module
+    std::shared_ptr<const Interface> load(const std::string& name);
+};
+
+// A separately compiled module, named after its file
+struct Module {
+    std::string name;
+    std::shared_ptr<Program> program;
+};
+
+// Imported module names that none of the modules provides
+std::vector<std::string> unlinked(const std::vector<Module>& modules);
+
+// Merges the modules into one Program for the Resolver. Top level externs
+// bind to the module defining the global and every import is checked
+// against the definitions it was compiled against. Throws runtime_error on
+// duplicate or missing definitions and on stale interfaces.
+std::shared_ptr<Program> link(const std::vector<Module>& modules);
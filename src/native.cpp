@@ -0,0 +1,147 @@
+#include "native.hpp"
+#include "parser.hpp"
+#include "types.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <dlfcn.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::runtime_error;
+using std::size_t;
+using std::string;
+using std::vector;
+
+NativeLibraries::NativeLibraries(const vector<string>& paths)
+    : handles {}
+{
+    for (const auto& path : paths) {
+        void* handle { dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL) };
+        if (handle == nullptr) {
+            string reason { dlerror() };
+            for (void* opened : handles)
+                dlclose(opened);
+            throw runtime_error("ERROR: " + reason);
+        }
+        handles.push_back(handle);
+    }
+
+    handles.push_back(dlopen(nullptr, RTLD_NOW));
+}
+
+NativeLibraries::~NativeLibraries()
+{
+    for (void* handle : handles)
+        if (handle != nullptr)
+            dlclose(handle);
+}
+
+void* NativeLibraries::symbol(const string& name) const
+{
+    for (void* handle : handles)
+        if (void* address = dlsym(handle, name.c_str()); address != nullptr)
+            return address;
+    return nullptr;
+}
+
+// Words of the interpreter to C values and back. Floats convert by value,
+// like float literals do.
+template <typename T>
+static T to_native(int64_t value)
+{
+    return static_cast<T>(value);
+}
+
+static int64_t from_native(int64_t value) { return value; }
+
+static int64_t from_native(double value)
+{
+    return std::fabs(value) < 0x1p63 ? static_cast<int64_t>(value) : 0;
+}
+
+template <typename R, typename... A, size_t... I>
+static int64_t invoke(
+    void* address, const int64_t* args, std::index_sequence<I...>)
+{
+    auto function { reinterpret_cast<R (*)(A...)>(address) };
+    return from_native(function(to_native<A>(args[I])...));
+}
+
+template <typename R, typename... A>
+static int64_t invoker(void* address, const int64_t* args)
+{
+    return invoke<R, A...>(address, args, std::index_sequence_for<A...> {});
+}
+
+// Picks the instantiation for the parameter types from i on, one template
+// argument at a time
+template <typename R, typename... A>
+static int64_t (*select(const vector<TypeWidth>& params, size_t i))(
+    void*, const int64_t*)
+{
+    if (i == params.size())
+        return &invoker<R, A...>;
+
+    if constexpr (sizeof...(A) < max_native_args) {
+        if (!params[i].floating)
+            return select<R, A..., int64_t>(params, i + 1);
+        if (params[i].bits == 32)
+            return select<R, A..., float>(params, i + 1);
+        return select<R, A..., double>(params, i + 1);
+    }
+
+    return nullptr;
+}
+
+NativeFunction::NativeFunction(
+    const NativeDecl& decl, const NativeLibraries& libraries)
+    : address { libraries.symbol(decl.name) }
+    , invoker { nullptr }
+    , params {}
+    , result { type_widths.at(decl.type) }
+{
+    if (address == nullptr)
+        throw runtime_error(
+            "ERROR: Could not find native function " + decl.name);
+
+    if (decl.param_types.size() > max_native_args)
+        throw runtime_error("ERROR: Native function " + decl.name
+            + " has more than " + std::to_string(max_native_args)
+            + " parameters");
+
+    for (const auto& type : decl.param_types)
+        params.push_back(type_widths.at(type));
+
+    if (!result.floating)
+        invoker = select<int64_t>(params, 0);
+    else if (result.bits == 32)
+        invoker = select<float>(params, 0);
+    else
+        invoker = select<double>(params, 0);
+}
+
+// The unused bits of narrow integers are unspecified in registers, both
+// ways: sign or zero extend from the declared width
+static int64_t narrow(int64_t value, const TypeWidth& width)
+{
+    if (width.floating || width.bits == 64)
+        return value;
+
+    int shift { 64 - width.bits };
+    if (width.is_signed)
+        return static_cast<int64_t>(static_cast<uint64_t>(value) << shift)
+            >> shift;
+    return static_cast<int64_t>(
+        static_cast<uint64_t>(value) & (~uint64_t { 0 } >> shift));
+}
+
+int64_t NativeFunction::call(int64_t* args) const
+{
+    for (size_t i = 0; i < params.size(); ++i)
+        args[i] = narrow(args[i], params[i]);
+    return narrow(invoker(address, args), result);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+#include "types.hpp"
+
+// Most parameters an extern fun can have
+inline constexpr std::size_t max_native_args { 4 };
+
+// Shared objects searched for extern functions, in order, then the running
+// process itself (which covers libc)
+class NativeLibraries {
+private:
+    std::vector<void*> handles;
+
+public:
+    // Throws runtime_error if a library cannot be opened
+    NativeLibraries(const std::vector<std::string>& paths);
+    ~NativeLibraries();
+    NativeLibraries(const NativeLibraries&) = delete;
+    NativeLibraries& operator=(const NativeLibraries&) = delete;
+
+    void* symbol(const std::string& name) const;
+};
+
+// An extern fun bound to its symbol. The invoker is instantiated for the
+// exact C signature (int64_t, float or double per parameter and result), so
+// a call is one indirect call with the arguments in the native registers.
+class NativeFunction {
+private:
+    using Invoker = int64_t (*)(void* address, const int64_t* args);
+
+    void* address;
+    Invoker invoker;
+    std::vector<TypeWidth> params;
+    TypeWidth result;
+
+public:
+    // Throws runtime_error if the symbol is missing or the signature has
+    // too many parameters
+    NativeFunction(const NativeDecl& decl, const NativeLibraries& libraries);
+
+    // Integer arguments are cut to their declared width first
+    int64_t call(int64_t* args) const;
+};
@@ -0,0 +1,912 @@
+#include "optimize.hpp"
+#include "callgraph.hpp"
+#include "parser.hpp"
+#include "resolve.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::make_shared;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+static size_t count_nodes(const shared_ptr<Expr>& expr)
+{
+    size_t count { 0 };
+    walk_expr(expr, [&](const shared_ptr<Expr>&) { ++count; });
+    return count;
+}
+
+// Writes a variable or calls a function (which may write globals)
+static bool has_effects(const shared_ptr<Expr>& expr)
+{
+    bool effects { false };
+    walk_expr(expr, [&](const shared_ptr<Expr>& node) {
+        if (dynamic_pointer_cast<Assign>(node) != nullptr
+            || dynamic_pointer_cast<FunCall>(node) != nullptr)
+            effects = true;
+    });
+    return effects;
+}
+
+static bool reads_globals(const shared_ptr<Expr>& expr)
+{
+    bool globals { false };
+    walk_expr(expr, [&](const shared_ptr<Expr>& node) {
+        if (auto ident = dynamic_pointer_cast<Ident>(node);
+            ident != nullptr && ident->slot.kind == Slot::Kind::GLOBAL)
+            globals = true;
+    });
+    return globals;
+}
+
+// Cheap enough to duplicate and immune to anything the callee does
+static bool trivial(const shared_ptr<Expr>& expr)
+{
+    if (dynamic_pointer_cast<Literal>(expr) != nullptr)
+        return true;
+
+    auto ident { dynamic_pointer_cast<Ident>(expr) };
+    return ident != nullptr && ident->slot.kind == Slot::Kind::LOCAL;
+}
+
+static shared_ptr<Ident> make_ident(string name, Slot slot)
+{
+    auto ident { make_shared<Ident>(name) };
+    ident->slot = slot;
+    return ident;
+}
+
+// Deep copy of expr. With args, locals 0..args.size() - 1 (the callee's
+// parameters) are replaced by copies of the matching argument.
+static shared_ptr<Expr> clone(
+    const shared_ptr<Expr>& expr, const vector<shared_ptr<Expr>>* args)
+{
+    if (auto number = dynamic_pointer_cast<Number>(expr); number != nullptr)
+        return make_shared<Number>(*number);
+
+    if (auto str = dynamic_pointer_cast<String>(expr); str != nullptr)
+        return make_shared<String>(*str);
+
+    if (auto ident = dynamic_pointer_cast<Ident>(expr); ident != nullptr) {
+        if (args != nullptr && ident->slot.kind == Slot::Kind::LOCAL
+            && ident->slot.index < args->size()) {
+            const auto& arg { (*args)[ident->slot.index] };
+            if (trivial(arg) || dynamic_pointer_cast<Grouping>(arg) != nullptr)
+                return clone(arg, nullptr);
+            return make_shared<Grouping>(clone(arg, nullptr));
+        }
+        return make_ident(ident->name, ident->slot);
+    }
+
+    if (auto assign = dynamic_pointer_cast<Assign>(expr); assign != nullptr) {
+        auto copy { make_shared<Assign>(
+            make_ident(assign->ident->name, assign->ident->slot),
+            clone(assign->expr, args)) };
+        copy->slot = assign->slot;
+        return copy;
+    }
+
+    if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr) {
+        Token op { unary->op };
+        return make_shared<Unary>(op, clone(unary->expr, args));
+    }
+
+    if (auto binary = dynamic_pointer_cast<Binary>(expr); binary != nullptr) {
+        Token op { binary->op };
+        return make_shared<Binary>(
+            clone(binary->left, args), op, clone(binary->right, args));
+    }
+
+    if (auto group = dynamic_pointer_cast<Grouping>(expr); group != nullptr)
+        return make_shared<Grouping>(clone(group->expr, args));
+
+    if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr) {
+        vector<shared_ptr<Expr>> exprs {};
+        for (const auto& arg : call->exprs)
+            exprs.push_back(clone(arg, args));
+
+        string name { call->name };
+        auto copy { make_shared<FunCall>(name, exprs) };
+        copy->slot = call->slot;
+        copy->tail = call->tail;
+        return copy;
+    }
+
+    return expr;
+}
+
+shared_ptr<Stmt> clone_stmt(const shared_ptr<Stmt>& stmt)
+{
+    if (stmt == nullptr)
+        return nullptr;
+
+    if (auto expr_stmt = dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        return make_shared<ExprStmt>(clone(expr_stmt->expr, nullptr));
+
+    if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr)
+        return make_shared<RetStmt>(
+            ret->expr ? clone(ret->expr, nullptr) : nullptr);
+
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr) {
+        vector<shared_ptr<Decl>> decls {};
+        for (const auto& decl : comp->decls)
+            if (auto var = dynamic_pointer_cast<VarDecl>(decl); var != nullptr)
+                decls.push_back(make_shared<VarDecl>(*var));
+
+        vector<shared_ptr<Stmt>> stmts {};
+        for (const auto& inner : comp->stmts)
+            stmts.push_back(clone_stmt(inner));
+
+        return make_shared<CompStmt>(decls, stmts);
+    }
+
+    if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt); if_stmt != nullptr)
+        return make_shared<IfStmt>(clone(if_stmt->cond, nullptr),
+            clone_stmt(if_stmt->if_branch), clone_stmt(if_stmt->else_branch));
+
+    if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr) {
+        auto copy { make_shared<LoopStmt>(
+            clone(loop->cond, nullptr), clone_stmt(loop->body)) };
+        copy->rotated = loop->rotated;
+        return copy;
+    }
+
+    if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt); loop != nullptr) {
+        vector<Reduction> reductions {};
+        for (const auto& reduction : loop->reductions)
+            reductions.push_back({ reduction.op,
+                make_ident(reduction.var->name, reduction.var->slot) });
+        return make_shared<ParLoopStmt>(clone(loop->init, nullptr),
+            clone(loop->end, nullptr), reductions, clone_stmt(loop->body));
+    }
+
+    if (dynamic_pointer_cast<BreakStmt>(stmt) != nullptr)
+        return make_shared<BreakStmt>();
+
+    if (dynamic_pointer_cast<ContStmt>(stmt) != nullptr)
+        return make_shared<ContStmt>();
+
+    return make_shared<EmptyStmt>();
+}
+
+shared_ptr<FunDecl> clone_function(const FunDecl& fun)
+{
+    auto copy { make_shared<FunDecl>(fun) };
+    copy->comp_stmt = dynamic_pointer_cast<CompStmt>(clone_stmt(fun.comp_stmt));
+    return copy;
+}
+
+Inliner::Inliner(size_t budget)
+    : budget { budget }
+    , bodies {}
+    , arity {}
+    , inlined { 0 }
+{
+}
+
+size_t Inliner::run(Program& program)
+{
+    inlined = 0;
+    if (budget == 0)
+        return inlined;
+
+    CallGraph graph { program };
+    bodies.assign(program.functions.size(), nullptr);
+    arity.assign(program.functions.size(), 0);
+
+    for (const auto& component : graph.bottom_up()) {
+        for (size_t fun : component)
+            for (auto& stmt : program.functions[fun]->comp_stmt->stmts)
+                statement(stmt);
+
+        for (size_t fun : component) {
+            arity[fun] = program.functions[fun]->param_list.size();
+            if (!graph.recursive(fun))
+                bodies[fun] = candidate(*program.functions[fun]);
+        }
+    }
+
+    return inlined;
+}
+
+size_t Inliner::run(const Program& program, shared_ptr<Stmt>& stmt)
+{
+    inlined = 0;
+    if (budget == 0)
+        return inlined;
+
+    if (bodies.size() != program.functions.size())
+        prepare(program);
+
+    statement(stmt);
+    return inlined;
+}
+
+void Inliner::prepare(const Program& program)
+{
+    CallGraph graph { program };
+    bodies.assign(program.functions.size(), nullptr);
+    arity.assign(program.functions.size(), 0);
+
+    for (size_t fun = 0; fun < program.functions.size(); ++fun) {
+        arity[fun] = program.functions[fun]->param_list.size();
+        if (!graph.recursive(fun))
+            bodies[fun] = candidate(*program.functions[fun]);
+    }
+}
+
+// The returned expression of `fun name(params) { return expr; }`, if it only
+// touches its parameters and globals and fits the budget
+shared_ptr<Expr> Inliner::candidate(const FunDecl& fun) const
+{
+    const auto& body { *fun.comp_stmt };
+    if (body.stmts.size() != 1)
+        return nullptr;
+
+    auto ret { dynamic_pointer_cast<RetStmt>(body.stmts[0]) };
+    if (ret == nullptr || ret->expr == nullptr
+        || count_nodes(ret->expr) > budget)
+        return nullptr;
+
+    size_t params { fun.param_list.size() };
+    for (const auto& decl : body.decls) {
+        auto var { dynamic_pointer_cast<VarDecl>(decl) };
+        if (var == nullptr
+            || (var->slot.kind == Slot::Kind::LOCAL
+                && var->slot.index >= params))
+            return nullptr;
+    }
+
+    bool ok { true };
+    walk_expr(ret->expr, [&](const shared_ptr<Expr>& node) {
+        if (auto ident = dynamic_pointer_cast<Ident>(node); ident != nullptr
+            && ident->slot.kind == Slot::Kind::LOCAL
+            && ident->slot.index >= params)
+            ok = false;
+        if (auto assign = dynamic_pointer_cast<Assign>(node);
+            assign != nullptr && assign->slot.kind == Slot::Kind::LOCAL)
+            ok = false;
+    });
+
+    return ok ? ret->expr : nullptr;
+}
+
+void Inliner::statement(shared_ptr<Stmt>& stmt)
+{
+    if (auto expr_stmt = dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        expression(expr_stmt->expr);
+
+    else if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr)
+        expression(ret->expr);
+
+    else if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        for (auto& inner : comp->stmts)
+            statement(inner);
+
+    else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        expression(if_stmt->cond);
+        statement(if_stmt->if_branch);
+        if (if_stmt->else_branch)
+            statement(if_stmt->else_branch);
+    }
+
+    else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr) {
+        expression(loop->cond);
+        statement(loop->body);
+    }
+
+    else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr) {
+        expression(loop->init);
+        expression(loop->end);
+        statement(loop->body);
+    }
+}
+
+void Inliner::expression(shared_ptr<Expr>& expr)
+{
+    if (auto assign = dynamic_pointer_cast<Assign>(expr); assign != nullptr)
+        expression(assign->expr);
+
+    else if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr)
+        expression(unary->expr);
+
+    else if (auto binary = dynamic_pointer_cast<Binary>(expr);
+        binary != nullptr) {
+        expression(binary->left);
+        expression(binary->right);
+    }
+
+    else if (auto group = dynamic_pointer_cast<Grouping>(expr);
+        group != nullptr)
+        expression(group->expr);
+
+    else if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr) {
+        for (auto& arg : call->exprs)
+            expression(arg);
+
+        if (call->slot.kind != Slot::Kind::FUNCTION)
+            return;
+
+        size_t fun { call->slot.index };
+        auto body { bodies[fun] };
+        if (body == nullptr || call->exprs.size() != arity[fun])
+            return;
+
+        vector<size_t> uses(arity[fun], 0);
+        walk_expr(body, [&](const shared_ptr<Expr>& node) {
+            if (auto ident = dynamic_pointer_cast<Ident>(node);
+                ident != nullptr && ident->slot.kind == Slot::Kind::LOCAL)
+                ++uses[ident->slot.index];
+        });
+
+        // Arguments move from before the call to their use in the body, so
+        // they must not have effects, be evaluated twice, or read globals
+        // the body could change first
+        bool callee_effects { has_effects(body) };
+        for (size_t i = 0; i < call->exprs.size(); ++i) {
+            const auto& arg { call->exprs[i] };
+            if (trivial(arg))
+                continue;
+            if (has_effects(arg) || uses[i] > 1
+                || (callee_effects && reads_globals(arg)))
+                return;
+        }
+
+        auto group { make_shared<Grouping>(clone(body, &call->exprs)) };
+        ++inlined;
+
+        // Only matters when bodies were not flattened callees first
+        expression(group->expr);
+        expr = group;
+    }
+}
+
+TailCalls::TailCalls()
+    : fun { nullptr }
+    , temps {}
+    , locals {}
+    , jumps { 0 }
+{
+}
+
+size_t TailCalls::run(Program& program)
+{
+    size_t total { 0 };
+    for (auto fun : program.functions)
+        total += run(*fun);
+
+    return total;
+}
+
+size_t TailCalls::run(FunDecl& current)
+{
+    fun = &current;
+    temps.clear();
+    jumps = 0;
+
+    // A call starts with its locals at 0, so a jump has to zero them too
+    vector<shared_ptr<Ident>> used(fun->frame_size);
+    walk_stmt(fun->comp_stmt, [&](const shared_ptr<Expr>& expr) {
+        auto ident { dynamic_pointer_cast<Ident>(expr) };
+        if (ident != nullptr && ident->slot.kind == Slot::Kind::LOCAL
+            && ident->slot.index >= fun->param_list.size()
+            && ident->slot.index < used.size())
+            used[ident->slot.index] = ident;
+    });
+    locals.clear();
+    for (auto ident : used)
+        if (ident != nullptr)
+            locals.push_back(ident);
+
+    for (auto& stmt : fun->comp_stmt->stmts)
+        statement(stmt, false);
+
+    if (jumps == 0)
+        return jumps;
+
+    auto& body { *fun->comp_stmt };
+    body.stmts.push_back(make_shared<BreakStmt>());
+    auto inner { make_shared<CompStmt>(vector<shared_ptr<Decl>> {}, body.stmts) };
+    body.stmts = { make_shared<LoopStmt>(make_shared<Number>(1), inner) };
+    body.decls.insert(body.decls.end(), temps.begin(), temps.end());
+
+    return jumps;
+}
+
+void TailCalls::statement(shared_ptr<Stmt>& stmt, bool in_loop)
+{
+    if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr) {
+        auto expr { ret->expr };
+        while (auto group = dynamic_pointer_cast<Grouping>(expr))
+            expr = group->expr;
+
+        // Native calls go through the C calling convention, never a jump
+        auto call { dynamic_pointer_cast<FunCall>(expr) };
+        if (call == nullptr || call->slot.kind != Slot::Kind::FUNCTION)
+            return;
+        call->tail = true;
+
+        // A continue inside a loop would restart that loop instead
+        if (!in_loop && call->slot.kind == Slot::Kind::FUNCTION
+            && call->slot.index == fun->index
+            && call->exprs.size() == fun->param_list.size()) {
+            stmt = jump(*call);
+            ++jumps;
+        }
+    }
+
+    else if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        for (auto& inner : comp->stmts)
+            statement(inner, in_loop);
+
+    else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        statement(if_stmt->if_branch, in_loop);
+        if (if_stmt->else_branch)
+            statement(if_stmt->else_branch, in_loop);
+    }
+
+    else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr)
+        statement(loop->body, true);
+
+    else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr)
+        statement(loop->body, true);
+}
+
+// return f(a, b);  =>  { _tail0 = a; _tail1 = b; a = _tail0; b = _tail1;
+//                        x = 0; continue; }
+// Temporaries are only needed when more than one parameter changes.
+std::shared_ptr<Stmt> TailCalls::jump(const FunCall& call)
+{
+    vector<size_t> changed {};
+    for (size_t i = 0; i < call.exprs.size(); ++i) {
+        auto ident { dynamic_pointer_cast<Ident>(call.exprs[i]) };
+        if (ident == nullptr || ident->slot.kind != Slot::Kind::LOCAL
+            || ident->slot.index != i)
+            changed.push_back(i);
+    }
+
+    auto param = [&](size_t i) {
+        return make_ident(fun->param_list[i], { Slot::Kind::LOCAL, i });
+    };
+    auto assign = [](shared_ptr<Ident> ident, shared_ptr<Expr> expr) {
+        auto node { make_shared<Assign>(ident, expr) };
+        node->slot = node->ident->slot;
+        return make_shared<ExprStmt>(node);
+    };
+
+    vector<shared_ptr<Stmt>> stmts {};
+    if (changed.size() <= 1) {
+        for (size_t i : changed)
+            stmts.push_back(assign(param(i), call.exprs[i]));
+    } else {
+        for (size_t k = temps.size(); k < changed.size(); ++k) {
+            string name { "_tail" + std::to_string(fun->frame_size) };
+            string type { "i64" };
+            auto temp { make_shared<VarDecl>(name, type, TokenType::AUTO) };
+            temp->slot = { Slot::Kind::LOCAL, fun->frame_size++ };
+            temps.push_back(temp);
+        }
+
+        for (size_t k = 0; k < changed.size(); ++k)
+            stmts.push_back(assign(
+                make_ident(temps[k]->ident, temps[k]->slot),
+                call.exprs[changed[k]]));
+        for (size_t k = 0; k < changed.size(); ++k)
+            stmts.push_back(assign(param(changed[k]),
+                make_ident(temps[k]->ident, temps[k]->slot)));
+    }
+    for (auto local : locals)
+        stmts.push_back(assign(
+            make_ident(local->name, local->slot), make_shared<Number>(0)));
+    stmts.push_back(make_shared<ContStmt>());
+
+    return make_shared<CompStmt>(vector<shared_ptr<Decl>> {}, stmts);
+}
+
+static shared_ptr<ExprStmt> assign_stmt(
+    shared_ptr<Ident> ident, shared_ptr<Expr> expr)
+{
+    auto node { make_shared<Assign>(ident, expr) };
+    node->slot = node->ident->slot;
+    return make_shared<ExprStmt>(node);
+}
+
+static bool local(const shared_ptr<Expr>& expr, size_t slot)
+{
+    auto ident { dynamic_pointer_cast<Ident>(expr) };
+    return ident != nullptr && ident->slot.kind == Slot::Kind::LOCAL
+        && ident->slot.index == slot;
+}
+
+LoopOptimizer::LoopOptimizer()
+    : fun { nullptr }
+    , stats { 0, 0, 0 }
+{
+}
+
+LoopOptimizer::Stats LoopOptimizer::run(Program& program)
+{
+    Stats total { 0, 0, 0 };
+
+    for (auto current : program.functions) {
+        for (auto& stmt : current->comp_stmt->stmts) {
+            auto part { run(*current, stmt) };
+            total.hoisted += part.hoisted;
+            total.reduced += part.reduced;
+            total.rotated += part.rotated;
+        }
+    }
+
+    return total;
+}
+
+LoopOptimizer::Stats LoopOptimizer::run(FunDecl& current, shared_ptr<Stmt>& stmt)
+{
+    fun = &current;
+    stats = { 0, 0, 0 };
+    statement(stmt);
+    return stats;
+}
+
+shared_ptr<Ident> LoopOptimizer::temp(const char* prefix)
+{
+    string name { prefix + std::to_string(fun->frame_size) };
+    string type { "i64" };
+    auto decl { make_shared<VarDecl>(name, type, TokenType::AUTO) };
+    decl->slot = { Slot::Kind::LOCAL, fun->frame_size++ };
+    fun->comp_stmt->decls.push_back(decl);
+
+    return make_ident(decl->ident, decl->slot);
+}
+
+void LoopOptimizer::statement(shared_ptr<Stmt>& stmt)
+{
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        for (auto& inner : comp->stmts)
+            statement(inner);
+
+    else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        statement(if_stmt->if_branch);
+        if (if_stmt->else_branch)
+            statement(if_stmt->else_branch);
+    }
+
+    else if (dynamic_pointer_cast<LoopStmt>(stmt) != nullptr)
+        loop(stmt);
+
+    // Only loops inside the body: the iterations themselves are scheduled
+    // by the runtime
+    else if (auto par = dynamic_pointer_cast<ParLoopStmt>(stmt); par != nullptr)
+        statement(par->body);
+}
+
+void LoopOptimizer::loop(shared_ptr<Stmt>& stmt)
+{
+    auto node { dynamic_pointer_cast<LoopStmt>(stmt) };
+    statement(node->body);
+
+    Effects effects { {}, {}, false };
+    auto record = [&](const shared_ptr<Expr>& expr) {
+        if (auto assign = dynamic_pointer_cast<Assign>(expr);
+            assign != nullptr) {
+            if (assign->slot.kind == Slot::Kind::LOCAL)
+                effects.locals.push_back(assign->slot.index);
+            else
+                effects.globals.push_back(assign->slot.index);
+        } else if (dynamic_pointer_cast<FunCall>(expr) != nullptr)
+            effects.calls = true;
+    };
+    walk_expr(node->cond, record);
+    walk_stmt(node->body, record);
+
+    vector<shared_ptr<Stmt>> preheader {};
+    hoist(node->cond, effects, preheader);
+    walk_roots(node->body, [&](shared_ptr<Expr>& expr) {
+        hoist(expr, effects, preheader);
+    });
+    reduce(*node, preheader);
+
+    shared_ptr<Stmt> result { node };
+    auto constant { dynamic_pointer_cast<Number>(node->cond) };
+    if (constant == nullptr) {
+        // if (c) loop (c) body, the inner condition is tested at the bottom
+        node->rotated = true;
+        result = make_shared<IfStmt>(clone(node->cond, nullptr), node, nullptr);
+        ++stats.rotated;
+    } else if (constant->number != 0) {
+        node->rotated = true;
+        ++stats.rotated;
+    }
+
+    if (preheader.empty()) {
+        stmt = result;
+        return;
+    }
+
+    preheader.push_back(result);
+    stmt = make_shared<CompStmt>(vector<shared_ptr<Decl>> {}, preheader);
+}
+
+// Safe to evaluate once before the loop instead of where it is: no effects,
+// cannot trap (no / or %) and reads nothing the loop writes
+bool LoopOptimizer::invariant(
+    const shared_ptr<Expr>& expr, const Effects& effects) const
+{
+    bool ok { true };
+    walk_expr(expr, [&](const shared_ptr<Expr>& node) {
+        if (dynamic_pointer_cast<Assign>(node) != nullptr
+            || dynamic_pointer_cast<FunCall>(node) != nullptr)
+            ok = false;
+
+        else if (auto binary = dynamic_pointer_cast<Binary>(node);
+            binary != nullptr
+            && (binary->op.token_type == TokenType::DIV
+                || binary->op.token_type == TokenType::MOD))
+            ok = false;
+
+        else if (auto ident = dynamic_pointer_cast<Ident>(node);
+            ident != nullptr) {
+            const auto& written { ident->slot.kind == Slot::Kind::LOCAL
+                    ? effects.locals
+                    : effects.globals };
+            if (ident->slot.kind == Slot::Kind::UNRESOLVED
+                || (ident->slot.kind == Slot::Kind::GLOBAL && effects.calls)
+                || std::find(written.begin(), written.end(), ident->slot.index)
+                    != written.end())
+                ok = false;
+        }
+    });
+    return ok;
+}
+
+// Replaces the largest invariant subexpressions that do some work
+void LoopOptimizer::hoist(shared_ptr<Expr>& expr, const Effects& effects,
+    vector<shared_ptr<Stmt>>& preheader)
+{
+    bool computes { false };
+    walk_expr(expr, [&](const shared_ptr<Expr>& node) {
+        if (dynamic_pointer_cast<Binary>(node) != nullptr
+            || dynamic_pointer_cast<Unary>(node) != nullptr)
+            computes = true;
+    });
+
+    if (computes && invariant(expr, effects)) {
+        auto ident { temp("_licm") };
+        preheader.push_back(assign_stmt(ident, expr));
+        expr = make_ident(ident->name, ident->slot);
+        ++stats.hoisted;
+        return;
+    }
+
+    if (auto assign = dynamic_pointer_cast<Assign>(expr); assign != nullptr)
+        hoist(assign->expr, effects, preheader);
+
+    else if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr)
+        hoist(unary->expr, effects, preheader);
+
+    else if (auto binary = dynamic_pointer_cast<Binary>(expr);
+        binary != nullptr) {
+        hoist(binary->left, effects, preheader);
+        hoist(binary->right, effects, preheader);
+    }
+
+    else if (auto group = dynamic_pointer_cast<Grouping>(expr);
+        group != nullptr)
+        hoist(group->expr, effects, preheader);
+
+    else if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr)
+        for (auto& arg : call->exprs)
+            hoist(arg, effects, preheader);
+}
+
+// i = i + c as a statement of the body, and no other write to i:
+// every i * k (k a literal) becomes _iv, set to i * k before the loop and
+// stepped by c * k right after i is
+void LoopOptimizer::reduce(LoopStmt& loop, vector<shared_ptr<Stmt>>& preheader)
+{
+    auto body { dynamic_pointer_cast<CompStmt>(loop.body) };
+    if (body == nullptr)
+        return;
+
+    for (size_t j = 0; j < body->stmts.size(); ++j) {
+        auto expr_stmt { dynamic_pointer_cast<ExprStmt>(body->stmts[j]) };
+        auto update { expr_stmt ? dynamic_pointer_cast<Assign>(expr_stmt->expr)
+                                : nullptr };
+        if (update == nullptr || update->slot.kind != Slot::Kind::LOCAL)
+            continue;
+
+        size_t var { update->slot.index };
+        auto step_expr { dynamic_pointer_cast<Binary>(update->expr) };
+        if (step_expr == nullptr)
+            continue;
+
+        shared_ptr<Number> step { nullptr };
+        TokenType op { step_expr->op.token_type };
+        if (op == TokenType::ADD && local(step_expr->left, var))
+            step = dynamic_pointer_cast<Number>(step_expr->right);
+        else if (op == TokenType::ADD && local(step_expr->right, var))
+            step = dynamic_pointer_cast<Number>(step_expr->left);
+        else if (op == TokenType::SUB && local(step_expr->left, var))
+            step = dynamic_pointer_cast<Number>(step_expr->right);
+        if (step == nullptr)
+            continue;
+        int64_t delta { op == TokenType::SUB ? -step->number : step->number };
+
+        size_t writes { 0 };
+        auto count = [&](const shared_ptr<Expr>& node) {
+            if (auto assign = dynamic_pointer_cast<Assign>(node);
+                assign != nullptr && assign->slot.kind == Slot::Kind::LOCAL
+                && assign->slot.index == var)
+                ++writes;
+        };
+        walk_expr(loop.cond, count);
+        walk_stmt(loop.body, count);
+        if (writes != 1)
+            continue;
+
+        // One derived variable per distinct factor
+        vector<std::pair<int64_t, shared_ptr<Ident>>> derived {};
+        auto replace = [&](auto& self, shared_ptr<Expr>& expr) -> void {
+            if (auto binary = dynamic_pointer_cast<Binary>(expr);
+                binary != nullptr && binary->op.token_type == TokenType::MUL) {
+                shared_ptr<Number> factor { nullptr };
+                if (local(binary->left, var))
+                    factor = dynamic_pointer_cast<Number>(binary->right);
+                else if (local(binary->right, var))
+                    factor = dynamic_pointer_cast<Number>(binary->left);
+
+                if (factor != nullptr) {
+                    auto found { std::find_if(derived.begin(), derived.end(),
+                        [&](const auto& entry) {
+                            return entry.first == factor->number;
+                        }) };
+                    if (found == derived.end()) {
+                        derived.push_back({ factor->number, temp("_iv") });
+                        found = derived.end() - 1;
+                    }
+                    expr = make_ident(found->second->name, found->second->slot);
+                    return;
+                }
+            }
+
+            if (auto assign = dynamic_pointer_cast<Assign>(expr);
+                assign != nullptr)
+                self(self, assign->expr);
+            else if (auto unary = dynamic_pointer_cast<Unary>(expr);
+                unary != nullptr)
+                self(self, unary->expr);
+            else if (auto binary = dynamic_pointer_cast<Binary>(expr);
+                binary != nullptr) {
+                self(self, binary->left);
+                self(self, binary->right);
+            } else if (auto group = dynamic_pointer_cast<Grouping>(expr);
+                group != nullptr)
+                self(self, group->expr);
+            else if (auto call = dynamic_pointer_cast<FunCall>(expr);
+                call != nullptr)
+                for (auto& arg : call->exprs)
+                    self(self, arg);
+        };
+        replace(replace, loop.cond);
+        walk_roots(loop.body, [&](shared_ptr<Expr>& expr) {
+            replace(replace, expr);
+        });
+
+        vector<shared_ptr<Stmt>> steps {};
+        for (const auto& [factor, ident] : derived) {
+            Token mul { TokenType::MUL, "*", 0 };
+            Token add { TokenType::ADD, "+", 0 };
+            preheader.push_back(assign_stmt(make_ident(ident->name, ident->slot),
+                make_shared<Binary>(make_ident(update->ident->name, update->slot),
+                    mul, make_shared<Number>(factor))));
+            steps.push_back(assign_stmt(make_ident(ident->name, ident->slot),
+                make_shared<Binary>(make_ident(ident->name, ident->slot), add,
+                    make_shared<Number>(delta * factor))));
+            ++stats.reduced;
+        }
+        body->stmts.insert(
+            body->stmts.begin() + j + 1, steps.begin(), steps.end());
+        j += steps.size();
+    }
+}
+
+// Globals named in stmt, by expressions or by extern declarations
+static void globals_used(const shared_ptr<Stmt>& stmt, vector<bool>& used)
+{
+    walk_stmt(stmt, [&](const shared_ptr<Expr>& expr) {
+        if (auto ident = dynamic_pointer_cast<Ident>(expr);
+            ident != nullptr && ident->slot.kind == Slot::Kind::GLOBAL)
+            used[ident->slot.index] = true;
+    });
+
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr) {
+        for (auto decl : comp->decls)
+            if (auto var = dynamic_pointer_cast<VarDecl>(decl);
+                var != nullptr && var->slot.kind == Slot::Kind::GLOBAL)
+                used[var->slot.index] = true;
+        for (auto inner : comp->stmts)
+            globals_used(inner, used);
+    } else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        globals_used(if_stmt->if_branch, used);
+        globals_used(if_stmt->else_branch, used);
+    } else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt);
+        loop != nullptr)
+        globals_used(loop->body, used);
+    else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr)
+        globals_used(loop->body, used);
+}
+
+DeadCode::DeadCode(std::string entry)
+    : entry { std::move(entry) }
+{
+}
+
+DeadCode::Stats DeadCode::run(Program& program)
+{
+    Stats removed { 0, 0, 0 };
+
+    auto found { std::find_if(program.functions.begin(),
+        program.functions.end(),
+        [&](const auto& fun) { return fun->name == entry; }) };
+    if (found == program.functions.end())
+        return removed;
+
+    CallGraph graph { program };
+    vector<bool> live { graph.reachable((*found)->index) };
+    vector<bool> live_globals(program.globals.size(), false);
+    vector<bool> live_natives(program.natives.size(), false);
+
+    for (size_t fun = 0; fun < live.size(); ++fun) {
+        if (!live[fun])
+            continue;
+        for (size_t native : graph.native_calls(fun))
+            live_natives[native] = true;
+        globals_used(program.functions[fun]->comp_stmt, live_globals);
+    }
+
+    vector<shared_ptr<Decl>> decls {};
+    for (auto decl : program.decls) {
+        if (auto fun = dynamic_pointer_cast<FunDecl>(decl);
+            fun != nullptr && !live[fun->index]) {
+            ++removed.functions;
+            continue;
+        }
+        if (auto var = dynamic_pointer_cast<VarDecl>(decl);
+            var != nullptr && !live_globals[var->slot.index]) {
+            ++removed.globals;
+            continue;
+        }
+        if (auto native = dynamic_pointer_cast<NativeDecl>(decl);
+            native != nullptr && !live_natives[native->index]) {
+            ++removed.natives;
+            continue;
+        }
+        decls.push_back(decl);
+    }
+
+    if (decls.size() != program.decls.size()) {
+        program.decls = std::move(decls);
+        Resolver {}.resolve(program);
+    }
+
+    return removed;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+
+// Deep copies, so a pass can work on a function without touching the
+// original (used when tiering up)
+std::shared_ptr<Stmt> clone_stmt(const std::shared_ptr<Stmt>& stmt);
+std::shared_ptr<FunDecl> clone_function(const FunDecl& fun);
+
+// Replaces calls to small single-expression functions by their body:
+//     fun i32 sum(a, b) { return a + b; }   sum(x, 1)  =>  (x + 1)
+// Functions are visited callees first so helpers of helpers flatten too;
+// recursive functions are never inlined. The budget caps the number of
+// expression nodes a callee may have. Expects a resolved program.
+class Inliner {
+private:
+    std::size_t budget;
+    std::vector<std::shared_ptr<Expr>> bodies; // inlinable, by function
+    std::vector<std::size_t> arity;
+    std::size_t inlined;
+
+    void prepare(const Program& program);
+    std::shared_ptr<Expr> candidate(const FunDecl& fun) const;
+    void statement(std::shared_ptr<Stmt>& stmt);
+    void expression(std::shared_ptr<Expr>& expr);
+
+public:
+    Inliner(std::size_t budget);
+    std::size_t run(Program& program); // number of calls inlined
+    // Inlines into one statement, taking callee bodies from program as they
+    // are and re-inlining into what was inlined
+    std::size_t run(const Program& program, std::shared_ptr<Stmt>& stmt);
+};
+
+// Marks every call that is the operand of a return as a tail call and turns
+// self-recursive tail calls into a jump back to the top of the function:
+// the body is wrapped in loop (1) { ... break; } and each such return
+// becomes parameter assignments followed by continue. Keeps slots and
+// frame sizes up to date.
+class TailCalls {
+private:
+    FunDecl* fun;
+    std::vector<std::shared_ptr<VarDecl>> temps;
+    std::vector<std::shared_ptr<Ident>> locals; // reset by every jump
+    std::size_t jumps;
+
+    void statement(std::shared_ptr<Stmt>& stmt, bool in_loop);
+    std::shared_ptr<Stmt> jump(const FunCall& call);
+
+public:
+    TailCalls();
+    std::size_t run(Program& program); // number of calls turned into jumps
+    std::size_t run(FunDecl& fun);
+};
+
+// Classic loop optimizations over LoopStmt, inner loops first:
+//  - invariant arithmetic (no calls, no traps, operands not written in the
+//    loop) is computed once into a temporary before the loop
+//  - for an induction variable stepped once per iteration by i = i + c,
+//    i * k is replaced by a temporary that is stepped by c * k instead
+//  - loop (c) body becomes if (c) loop (c) body with the inner condition
+//    tested after the body, so each iteration does one test and jump
+// Keeps slots and frame sizes up to date.
+class LoopOptimizer {
+public:
+    struct Stats {
+        std::size_t hoisted;
+        std::size_t reduced;
+        std::size_t rotated;
+    };
+
+private:
+    // What a loop may change while it runs
+    struct Effects {
+        std::vector<std::size_t> locals;
+        std::vector<std::size_t> globals;
+        bool calls;
+    };
+
+    FunDecl* fun;
+    Stats stats;
+
+    void statement(std::shared_ptr<Stmt>& stmt);
+    void loop(std::shared_ptr<Stmt>& stmt);
+    bool invariant(
+        const std::shared_ptr<Expr>& expr, const Effects& effects) const;
+    void hoist(std::shared_ptr<Expr>& expr, const Effects& effects,
+        std::vector<std::shared_ptr<Stmt>>& preheader);
+    void reduce(LoopStmt& loop, std::vector<std::shared_ptr<Stmt>>& preheader);
+    std::shared_ptr<Ident> temp(const char* prefix);
+
+public:
+    LoopOptimizer();
+    Stats run(Program& program);
+    // Loops in stmt, temporaries go into fun's frame
+    Stats run(FunDecl& fun, std::shared_ptr<Stmt>& stmt);
+};
+
+// Whole program: drops the functions the entry point can never call and the
+// globals and extern functions that only dead code used, then resolves the
+// program again so later phases only see what can run. A program without
+// the entry point (a library module) is left alone.
+class DeadCode {
+public:
+    struct Stats {
+        std::size_t functions;
+        std::size_t globals;
+        std::size_t natives;
+    };
+
+private:
+    std::string entry;
+
+public:
+    DeadCode(std::string entry);
+    Stats run(Program& program);
+};
+
+// The optimizing pipeline, shared by the up front compile and tiering
+struct OptOptions {
+    std::size_t inline_budget; // expression nodes, 0 disables inlining
+    bool tail_calls;
+    bool loop_opts;
+};
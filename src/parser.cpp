@@ -1,32 +1,47 @@
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "diagnostics.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "semantic.hpp"
 
 using std::dynamic_pointer_cast;
 using std::make_shared;
-using std::runtime_error;
 using std::shared_ptr;
+using std::size_t;
 using std::string;
 using std::vector;
 
-shared_ptr<Program> Parser::program()
+template <typename Derived>
+shared_ptr<Program> Parser<Derived>::program()
 {
     vector<shared_ptr<Decl>> decls {};
 
     while (!tokens.match(TokenType::FEOF)) {
-        decls.push_back(declaration());
+        size_t start { tokens.position() };
+        try {
+            decls.push_back(self().declaration());
+        } catch (const CompileError& e) {
+            diags.error(e);
+            sync_declaration(start);
+        }
     }
 
     return make_shared<Program>(decls);
 }
 
-shared_ptr<Decl> Parser::declaration()
+template <typename Derived>
+shared_ptr<Decl> Parser<Derived>::declaration()
 {
     if (tokens.match(TokenType::FUN)) {
         string name {};
@@ -44,14 +59,55 @@ shared_ptr<Decl> Parser::declaration()
             name = tokens.cur().token_str;
             tokens.advance(1);
         } else
-            tokens.expect(TokenType::IDENT,
-                "Expected an identifier but got " + tokens.cur().token_str
-                    + " instead");
+            tokens.expect(TokenType::IDENT, "an identifier");
 
-        vector<string> params { param_list() };
-        shared_ptr<CompStmt> comp_stmt { compound() };
+        vector<string> params { self().param_list() };
+        shared_ptr<CompStmt> comp_stmt { self().compound() };
 
         return make_shared<FunDecl>(name, type, params, comp_stmt);
+    } else if (tokens.match(TokenType::EXTERN)
+        && tokens.peek(1).token_type == TokenType::FUN) {
+        tokens.advance(2);
+
+        string type { "i32" };
+        if (tokens.match(TokenType::BASE_TYPE)) {
+            type = tokens.cur().token_str;
+            tokens.advance(1);
+        }
+
+        tokens.expect(TokenType::IDENT, "an identifier");
+        string name { tokens.cur().token_str };
+        tokens.advance(1);
+
+        // extern fun f64 pow(f64 x, f64 y); the names are optional
+        tokens.expect(TokenType::LPAREN, "a '('");
+        tokens.advance(1);
+        vector<string> param_types {};
+
+        while (!tokens.match(TokenType::RPAREN)) {
+            if (tokens.match(TokenType::FEOF))
+                error("Expected ')' but reached EOF");
+
+            if (tokens.match(TokenType::BASE_TYPE)) {
+                param_types.push_back(tokens.cur().token_str);
+                tokens.advance(1);
+                if (tokens.match(TokenType::IDENT))
+                    tokens.advance(1);
+            } else {
+                tokens.expect(TokenType::IDENT, "a parameter");
+                param_types.push_back("i32");
+                tokens.advance(1);
+            }
+
+            if (tokens.match(TokenType::COMMA))
+                tokens.advance(1);
+        }
+
+        tokens.advance(1);
+        tokens.expect(TokenType::SCOLON, "a ';'");
+        tokens.advance(1);
+
+        return make_shared<NativeDecl>(name, type, param_types);
     } else if (tokens.match(TokenType::AUTO)
         || tokens.match(TokenType::EXTERN)) {
         TokenType var_type { tokens.cur().token_type };
@@ -66,54 +122,96 @@ shared_ptr<Decl> Parser::declaration()
         }
 
         // Variable name
-        tokens.expect(TokenType::IDENT,
-            "Expected an identifier but got " + tokens.cur().token_str
-                + " instead!");
+        tokens.expect(TokenType::IDENT, "an identifier");
         string ident { tokens.cur().token_str };
         tokens.advance(1);
-        tokens.expect(TokenType::SCOLON,
-            "Expected ';' but got " + tokens.cur().token_str + " instead!");
+        tokens.expect(TokenType::SCOLON, "a ';'");
 
         tokens.advance(1);
 
         return make_shared<VarDecl>(ident, type, var_type);
+    } else if (tokens.match(TokenType::IMPORT)) {
+        tokens.advance(1);
+
+        tokens.expect(TokenType::IDENT, "a module name");
+        string module { tokens.cur().token_str };
+        tokens.advance(1);
+        tokens.expect(TokenType::SCOLON, "a ';'");
+        tokens.advance(1);
+
+        return make_shared<ImportDecl>(module);
     }
 
-    throw runtime_error("ERROR: Expected a declaration got a "
-        + tokens.cur().token_str + " instead!");
+    error("Expected a declaration but got a " + tokens.cur().token_str
+        + " instead!");
 }
 
-vector<string> Parser::param_list()
+template <typename Derived>
+vector<string> Parser<Derived>::param_list()
 {
-    tokens.expect(TokenType::LPAREN,
-        "Expected a '(' but got a " + tokens.cur().token_str + " instead");
+    tokens.expect(TokenType::LPAREN, "a '('");
     tokens.advance(1);
     vector<string> params {};
 
     while (!tokens.match(TokenType::RPAREN)) {
         if (tokens.match(TokenType::FEOF))
-            throw runtime_error("Expected ')' but reached EOF");
+            error("Expected ')' but reached EOF");
 
-        tokens.expect(TokenType::IDENT,
-            "Expected an parameter but got " + tokens.cur().token_str
-                + " instead!");
+        tokens.expect(TokenType::IDENT, "a parameter");
         params.push_back(tokens.cur().token_str);
         tokens.advance(1);
+
+        // Separating commas are optional: (a b) and (a, b) are the same
+        if (tokens.match(TokenType::COMMA))
+            tokens.advance(1);
     }
 
     tokens.advance(1);
     return params;
 }
 
-shared_ptr<Stmt> Parser::statement()
+// Syntax-only block, Semantic replaces this with a scoped version
+template <typename Derived>
+shared_ptr<CompStmt> Parser<Derived>::compound()
+{
+    tokens.expect(TokenType::LBRACE, "a '{'");
+    tokens.advance(1);
+
+    vector<shared_ptr<Decl>> decls {};
+    vector<shared_ptr<Stmt>> stmts {};
+
+    while (!tokens.match(TokenType::RBRACE)) {
+        if (tokens.match(TokenType::FEOF))
+            error("Expected a '}' but got " + tokens.peek(-1).token_str
+                + " instead!");
+
+        size_t start { tokens.position() };
+        try {
+            if (tokens.match(TokenType::EXTERN)
+                || tokens.match(TokenType::AUTO)
+                || tokens.match(TokenType::BASE_TYPE))
+                decls.push_back(self().declaration());
+            else
+                stmts.push_back(self().statement());
+        } catch (const CompileError& e) {
+            diags.error(e);
+            sync_statement(start);
+        }
+    }
+    tokens.advance(1);
+
+    return make_shared<CompStmt>(decls, stmts);
+}
+
+template <typename Derived>
+shared_ptr<Stmt> Parser<Derived>::statement()
 {
     switch (tokens.cur().token_type) {
         // Return Statement "return" <expression> ";"
     case TokenType::RETURN: {
         tokens.advance(1);
-        shared_ptr<Expr> expr = expression();
-        tokens.expect(TokenType::SCOLON,
-            "Expected a ';' but got a " + tokens.cur().token_str + " instead!");
+        shared_ptr<Expr> expr = self().expression();
+        tokens.expect(TokenType::SCOLON, "a ';'");
         tokens.advance(1);
         return make_shared<RetStmt>(expr);
     }
@@ -121,21 +219,19 @@ shared_ptr<Stmt> Parser::statement()
         // If statement "if" <statement> [ "else" <statement> ]
     case TokenType::IF: {
         tokens.advance(1);
-        tokens.expect(TokenType::LPAREN,
-            "Expected a '(' but got a " + tokens.cur().token_str + " instead!");
+        tokens.expect(TokenType::LPAREN, "a '('");
         tokens.advance(1);
-        shared_ptr<Expr> cond { expression() };
+        shared_ptr<Expr> cond { self().expression() };
 
-        tokens.expect(TokenType::RPAREN,
-            "Expected a ')' but got a " + tokens.cur().token_str + " instead!");
+        tokens.expect(TokenType::RPAREN, "a ')'");
 
         tokens.advance(1);
-        shared_ptr<Stmt> if_stmt { statement() };
+        shared_ptr<Stmt> if_stmt { self().statement() };
 
         shared_ptr<Stmt> else_stmt { nullptr };
         if (tokens.cur().token_type == TokenType::ELSE) {
             tokens.advance(1);
-            else_stmt = statement();
+            else_stmt = self().statement();
         }
 
         return make_shared<IfStmt>(cond, if_stmt, else_stmt);
@@ -143,169 +239,404 @@ shared_ptr<Stmt> Parser::statement()
 
         // Loop statement "loop" <statement>
     case TokenType::LOOP: {
+        if (tokens.peek(1).token_type == TokenType::PARALLEL)
+            return self().par_loop();
+
         tokens.advance(1);
-        tokens.expect(TokenType::LPAREN,
-            "Expected a '(' but got a " + tokens.cur().token_str + " instead!");
+        tokens.expect(TokenType::LPAREN, "a '('");
         tokens.advance(1);
-        shared_ptr<Expr> cond { expression() };
+        shared_ptr<Expr> cond { self().expression() };
 
-        tokens.expect(TokenType::RPAREN,
-            "Expected a ')' but got a " + tokens.cur().token_str + " instead!");
+        tokens.expect(TokenType::RPAREN, "a ')'");
         tokens.advance(1);
 
-        return make_shared<LoopStmt>(cond, statement());
+        return make_shared<LoopStmt>(cond, self().statement());
     }
 
         // Compound statement { ... }
     case TokenType::LBRACE: {
-        return compound();
+        return self().compound();
     }
 
         // Expression statement <expression> ";"
     default: {
-        shared_ptr<Expr> expr { expression() };
-        tokens.expect(TokenType::SCOLON,
-            "Expected a ';' but got a " + tokens.cur().token_str + " instead!");
+        shared_ptr<Expr> expr { self().expression() };
+        tokens.expect(TokenType::SCOLON, "a ';'");
         tokens.advance(1);
 
         return make_shared<ExprStmt>(expr);
     }
     }
 
-    throw runtime_error("ERROR: Not implemented yet!");
+    error("Not implemented yet!");
+}
+
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::expression() { return self().assign(); }
+
+// Parallel loop "loop" "parallel" "(" <ident> "=" <expression> ","
+// <expression> ")" [ "reduce" "(" ("+" | "*") <ident> { "," ... } ")" ]
+// <statement>
+template <typename Derived>
+shared_ptr<ParLoopStmt> Parser<Derived>::par_loop()
+{
+    size_t pos { tokens.cur().pos };
+    tokens.advance(2);
+    tokens.expect(TokenType::LPAREN, "a '('");
+    tokens.advance(1);
+
+    shared_ptr<Expr> init { self().assign() };
+    if (dynamic_pointer_cast<Assign>(init) == nullptr)
+        error("Expected the index of the parallel loop, as in i = 0, here!");
+    tokens.expect(TokenType::COMMA, "a ','");
+    tokens.advance(1);
+
+    shared_ptr<Expr> end { self().expression() };
+    tokens.expect(TokenType::RPAREN, "a ')'");
+    tokens.advance(1);
+
+    vector<Reduction> reductions {};
+    if (tokens.match(TokenType::REDUCE)) {
+        tokens.advance(1);
+        tokens.expect(TokenType::LPAREN, "a '('");
+        tokens.advance(1);
+
+        while (true) {
+            if (!tokens.match(TokenType::ADD) && !tokens.match(TokenType::MUL))
+                error("Expected + or * but got " + tokens.cur().token_str
+                    + " instead!");
+            Token op { tokens.cur() };
+            tokens.advance(1);
+
+            tokens.expect(TokenType::IDENT, "a variable");
+            auto var { dynamic_pointer_cast<Ident>(self().primary()) };
+            if (var == nullptr)
+                error("Expected a variable here!");
+            reductions.push_back({ op, var });
+
+            if (!tokens.match(TokenType::COMMA))
+                break;
+            tokens.advance(1);
+        }
+
+        tokens.expect(TokenType::RPAREN, "a ')'");
+        tokens.advance(1);
+    }
+
+    auto loop { make_shared<ParLoopStmt>(init, end, reductions, nullptr) };
+    loop->body = self().par_body(*loop, pos);
+    return loop;
 }
 
-shared_ptr<Expr> Parser::expression() { return assign(); }
+// Lets Semantic check the body against the loop header
+template <typename Derived>
+shared_ptr<Stmt> Parser<Derived>::par_body(const ParLoopStmt&, size_t)
+{
+    return self().statement();
+}
 
-shared_ptr<Expr> Parser::assign()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::assign()
 {
-    shared_ptr<Expr> expr = equality();
+    shared_ptr<Expr> expr = self().equality();
     if (tokens.match(TokenType::EQ)) {
         tokens.advance(1);
-        shared_ptr<Expr> right { assign() };
+        shared_ptr<Expr> right { self().assign() };
 
         auto ident { dynamic_pointer_cast<Ident>(expr) };
 
         if (!ident)
-            throw runtime_error("ERROR: Expected an lvalue here.!");
+            error("Expected an lvalue here!");
 
         expr = make_shared<Assign>(ident, right);
     }
     return expr;
 }
 
-shared_ptr<Expr> Parser::equality()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::equality()
 {
-    shared_ptr<Expr> expr = comparison();
+    shared_ptr<Expr> expr = self().comparison();
 
     while (tokens.match(TokenType::DEQ) || tokens.match(TokenType::NEQ)) {
         Token op { tokens.cur() };
         tokens.advance(1);
-        shared_ptr<Expr> right { comparison() };
+        shared_ptr<Expr> right { self().comparison() };
         expr = make_shared<Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-shared_ptr<Expr> Parser::comparison()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::comparison()
 {
-    shared_ptr<Expr> expr = term();
+    shared_ptr<Expr> expr = self().term();
 
     while (tokens.match(TokenType::GTE) || tokens.match(TokenType::GT)
         || tokens.match(TokenType::LTE) || tokens.match(TokenType::LT)) {
         Token op { tokens.cur() };
         tokens.advance(1);
-        shared_ptr<Expr> right { term() };
+        shared_ptr<Expr> right { self().term() };
         expr = make_shared<Binary>(expr, op, right);
     }
     return expr;
 }
 
-shared_ptr<Expr> Parser::term()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::term()
 {
-    shared_ptr<Expr> expr = factor();
+    shared_ptr<Expr> expr = self().factor();
 
     while (tokens.match(TokenType::ADD) || tokens.match(TokenType::SUB)) {
         Token op { tokens.cur() };
         tokens.advance(1);
-        shared_ptr<Expr> right { factor() };
+        shared_ptr<Expr> right { self().factor() };
         expr = make_shared<Binary>(expr, op, right);
     }
     return expr;
 }
 
-shared_ptr<Expr> Parser::factor()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::factor()
 {
-    shared_ptr<Expr> expr = unary();
+    shared_ptr<Expr> expr = self().unary();
 
-    while (tokens.match(TokenType::MUL) || tokens.match(TokenType::DIV)) {
+    while (tokens.match(TokenType::MUL) || tokens.match(TokenType::DIV)
+        || tokens.match(TokenType::MOD)) {
         Token op { tokens.cur() };
         tokens.advance(1);
-        shared_ptr<Expr> right { unary() };
+        shared_ptr<Expr> right { self().unary() };
         expr = make_shared<Binary>(expr, op, right);
     }
     return expr;
 }
 
-shared_ptr<Expr> Parser::unary()
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::unary()
 {
     if (tokens.match(TokenType::SUB) || tokens.match(TokenType::ADD)
         || tokens.match(TokenType::NOT)) {
         Token op = tokens.cur();
         tokens.advance(1);
-        shared_ptr<Expr> expr { unary() };
+        shared_ptr<Expr> expr { op.token_type == TokenType::SUB
+                    && tokens.match(TokenType::NUMBER)
+                ? number(true)
+                : self().unary() };
         return make_shared<Unary>(op, expr);
     }
 
-    return primary();
+    return self().primary();
+}
+
+// Syntax-only primary, identifiers are not resolved
+template <typename Derived>
+shared_ptr<Expr> Parser<Derived>::primary()
+{
+    if (tokens.match(TokenType::NUMBER))
+        return number();
+
+    if (tokens.match(TokenType::STRING)) {
+        Token tok { tokens.cur() };
+        tokens.advance(1);
+        return make_shared<String>(tok);
+    }
+
+    if (tokens.match(TokenType::LPAREN)) {
+        tokens.advance(1);
+        shared_ptr<Expr> expr { self().expression() };
+        tokens.expect(TokenType::RPAREN, "a ')'");
+        tokens.advance(1);
+        return make_shared<Grouping>(expr);
+    }
+
+    if (tokens.match(TokenType::IDENT)) {
+        if (tokens.peek(1).token_type == TokenType::LPAREN)
+            return self().funcall();
+
+        Token tok { tokens.cur() };
+        tokens.advance(1);
+        return make_shared<Ident>(tok.token_str);
+    }
+
+    error("Expected an expression but got " + tokens.cur().token_str
+        + " instead!");
 }
 
 // funcall: "(" + *expr + ")"
-shared_ptr<FunCall> Parser::funcall()
+template <typename Derived>
+shared_ptr<FunCall> Parser<Derived>::funcall()
 {
-    tokens.expect(TokenType::IDENT,
-        "Expected an identifier but got a " + tokens.cur().token_str
-            + " instead!");
+    tokens.expect(TokenType::IDENT, "an identifier");
 
     string name { tokens.cur().token_str };
     tokens.advance(1);
     // vector<shared_ptr<Expr>> exprs {};
 
-    tokens.expect(TokenType::LPAREN,
-        "Expected a '(' but got " + tokens.cur().token_str + " instead!");
+    tokens.expect(TokenType::LPAREN, "a '('");
     tokens.advance(1);
 
     vector<shared_ptr<Expr>> exprs {};
-    while (!tokens.match(TokenType::RPAREN))
-        exprs.push_back(expression());
+    while (!tokens.match(TokenType::RPAREN)) {
+        exprs.push_back(self().expression());
+        if (tokens.match(TokenType::COMMA))
+            tokens.advance(1);
+    }
 
     tokens.advance(1);
 
     return make_shared<FunCall>(name, exprs);
 }
 
-vector<shared_ptr<Expr>> Parser::arg_list()
+template <typename Derived>
+vector<shared_ptr<Expr>> Parser<Derived>::arg_list()
 {
-    tokens.expect(TokenType::LPAREN,
-        "Expected a '(' but got a " + tokens.cur().token_str + " instead");
+    tokens.expect(TokenType::LPAREN, "a '('");
     tokens.advance(1);
     vector<shared_ptr<Expr>> args {};
 
     while (!tokens.match(TokenType::RPAREN)) {
         if (tokens.match(TokenType::FEOF))
-            throw runtime_error("Expected ')' but reached EOF");
+            error("Expected ')' but reached EOF");
 
-        args.push_back(expression());
+        args.push_back(self().expression());
+        if (tokens.match(TokenType::COMMA))
+            tokens.advance(1);
     }
 
     tokens.advance(1);
     return args;
 }
 
-Parser::Parser(const TokenStream& tokens)
-    : tokens { tokens }
+template <typename Derived>
+void Parser<Derived>::error(string msg)
+{
+    throw CompileError { tokens.cur().pos, std::move(msg) };
+}
+
+template <typename Derived>
+shared_ptr<Number> Parser<Derived>::number(bool negated)
+{
+    const Token& tok { tokens.expect(TokenType::NUMBER, "a number") };
+
+    switch (tok.number.status) {
+    case NumberValue::Status::OUT_OF_RANGE:
+        error("The literal " + tok.token_str + " is out of range!");
+    case NumberValue::Status::MALFORMED:
+        error("The literal " + tok.token_str + " has no digits!");
+    case NumberValue::Status::OK:
+        break;
+    }
+
+    // Reals are computed with as int64_t, truncated towards zero
+    if (tok.number.floating && !(std::fabs(tok.number.real) < 0x1p63))
+        error("The literal " + tok.token_str + " is out of range!");
+
+    // Decimal integers are i64 values, only -9223372036854775808 gets to use
+    // the magnitude 2^63. Hex and binary literals are 64 bit patterns.
+    bool decimal { tok.token_str.size() < 2 || !isalpha(tok.token_str[1]) };
+    if (!tok.number.floating && decimal
+        && tok.number.integer > uint64_t { INT64_MAX } + negated)
+        error("The literal " + tok.token_str + " is out of range!");
+
+    auto number { make_shared<Number>(tok) };
+    tokens.advance(1);
+    return number;
+}
+
+// Skip the rest of a broken statement: up to and including its ';', or up to
+// the '}' closing the block or the next token that starts a statement
+template <typename Derived>
+void Parser<Derived>::sync_statement(size_t start)
+{
+    if (tokens.position() == start && !tokens.match(TokenType::RBRACE))
+        tokens.advance(1);
+
+    size_t depth { 0 };
+    while (!tokens.match(TokenType::FEOF)) {
+        switch (tokens.cur().token_type) {
+        case TokenType::SCOLON:
+            if (depth == 0) {
+                tokens.advance(1);
+                return;
+            }
+            break;
+        case TokenType::LBRACE:
+            ++depth;
+            break;
+        case TokenType::RBRACE:
+            if (depth == 0)
+                return;
+            --depth;
+            break;
+        case TokenType::RETURN:
+        case TokenType::IF:
+        case TokenType::LOOP:
+        case TokenType::AUTO:
+        case TokenType::EXTERN:
+            if (depth == 0)
+                return;
+            break;
+        default:
+            break;
+        }
+        tokens.advance(1);
+    }
+}
+
+// Skip to the next top level declaration, stepping over whole bodies
+template <typename Derived>
+void Parser<Derived>::sync_declaration(size_t start)
+{
+    if (tokens.position() == start)
+        tokens.advance(1);
+
+    size_t depth { 0 };
+    while (!tokens.match(TokenType::FEOF)) {
+        switch (tokens.cur().token_type) {
+        case TokenType::LBRACE:
+            ++depth;
+            break;
+        case TokenType::RBRACE:
+            if (depth > 0 && --depth == 0) {
+                tokens.advance(1);
+                return;
+            }
+            break;
+        case TokenType::SCOLON:
+            if (depth == 0) {
+                tokens.advance(1);
+                return;
+            }
+            break;
+        case TokenType::FUN:
+        case TokenType::AUTO:
+        case TokenType::EXTERN:
+        case TokenType::IMPORT:
+            if (depth == 0)
+                return;
+            break;
+        default:
+            break;
+        }
+        tokens.advance(1);
+    }
+}
+
+template <typename Derived>
+Parser<Derived>::Parser(TokenStream tokens, Diagnostics& diags)
+    : tokens { std::move(tokens) }
+    , diags { diags }
+{
+}
+
+template <typename Derived>
+shared_ptr<Program> Parser<Derived>::parse() { return self().program(); }
+
+SyntaxChecker::SyntaxChecker(TokenStream tokens, Diagnostics& diags)
+    : Parser { std::move(tokens), diags }
 {
 }
 
-shared_ptr<Program> Parser::parse() { return program(); }
+template class Parser<SyntaxChecker>;
+template class Parser<Semantic>;
@@ -1,52 +1,117 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "diagnostics.hpp"
 #include "lexer.hpp"
 
+// Storage of a name, filled in by the Resolver (resolve.hpp)
+struct Slot {
+    enum class Kind {
+        UNRESOLVED,
+        LOCAL, // index into the function's frame
+        GLOBAL, // index into Program::globals
+        FUNCTION, // index into Program::functions
+        NATIVE, // index into Program::natives
+    };
+
+    Kind kind { Kind::UNRESOLVED };
+    std::size_t index { 0 };
+};
+
+// Concrete node types, so hot paths can switch instead of dynamic_cast
+enum class ExprKind {
+    IDENT,
+    NUMBER,
+    STRING,
+    ASSIGN,
+    UNARY,
+    BINARY,
+    GROUPING,
+    FUNCALL,
+};
+
+enum class StmtKind {
+    EXPR,
+    RET,
+    COMP,
+    BREAK,
+    CONT,
+    EMPTY,
+    IF,
+    LOOP,
+    PARLOOP,
+};
+
 struct Expr {
     virtual ~Expr() { }
+    virtual ExprKind kind() const = 0;
 };
 
 struct Ident : Expr {
     std::string name;
+    Slot slot;
     Ident(std::string& name)
         : name { name }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::IDENT; }
 };
 
 struct Literal : Expr { };
 
 struct Number : Literal {
-    int64_t number;
-    Number(Token token)
-        : number { std::stoi(token.token_str) }
+    int64_t number; // what the interpreter computes with
+    double real { 0 };
+    bool floating { false }; // number is real truncated towards zero
+
+    Number(const Token& token)
+        : number { static_cast<int64_t>(token.number.integer) }
+        , real { token.number.real }
+        , floating { token.number.floating }
     {
+        // Parser::number rejects reals that do not fit
+        if (floating)
+            number = static_cast<int64_t>(real);
     }
+    Number(int64_t number)
+        : number { number }
+    {
+    }
+
+    ExprKind kind() const override { return ExprKind::NUMBER; }
 };
 
 struct String : Literal {
     std::string str;
+    std::string text; // without the backticks
     String(Token& token)
         : str { token.token_str }
+        , text { token.token_str.substr(1, token.token_str.length() - 2) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::STRING; }
 };
 
 struct Assign : Expr {
     std::shared_ptr<Ident> ident;
     std::shared_ptr<Expr> expr;
+    Slot slot; // same as ident->slot
 
     Assign(std::shared_ptr<Ident> ident, std::shared_ptr<Expr> expr)
         : ident { std::move(ident) }
         , expr { std::move(expr) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::ASSIGN; }
 };
 
 struct Unary : Expr {
@@ -58,6 +123,8 @@ struct Unary : Expr {
         , expr { std::move(expr) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::UNARY; }
 };
 
 struct Binary : Expr {
@@ -71,6 +138,8 @@ struct Binary : Expr {
         , right { std::move(right) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::BINARY; }
 };
 
 struct Grouping : Expr {
@@ -79,6 +148,8 @@ struct Grouping : Expr {
         : expr { std::move(expr) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::GROUPING; }
 };
 
 struct Decl {
@@ -87,6 +158,7 @@ struct Decl {
 
 struct Stmt {
     virtual ~Stmt() { }
+    virtual StmtKind kind() const = 0;
 };
 
 struct ExprStmt : Stmt {
@@ -95,6 +167,8 @@ struct ExprStmt : Stmt {
         : expr { std::move(expr) }
     {
     }
+
+    StmtKind kind() const override { return StmtKind::EXPR; }
 };
 
 struct RetStmt : Stmt {
@@ -103,6 +177,8 @@ struct RetStmt : Stmt {
         : expr { std::move(expr) }
     {
     }
+
+    StmtKind kind() const override { return StmtKind::RET; }
 };
 
 struct CompStmt : Stmt {
@@ -115,13 +191,21 @@ struct CompStmt : Stmt {
         , stmts { std::move(stmts) }
     {
     }
+
+    StmtKind kind() const override { return StmtKind::COMP; }
 };
 
-struct BreakStmt : Stmt { };
+struct BreakStmt : Stmt {
+    StmtKind kind() const override { return StmtKind::BREAK; }
+};
 
-struct ContStmt : Stmt { };
+struct ContStmt : Stmt {
+    StmtKind kind() const override { return StmtKind::CONT; }
+};
 
-struct EmptyStmt : Stmt { };
+struct EmptyStmt : Stmt {
+    StmtKind kind() const override { return StmtKind::EMPTY; }
+};
 
 struct VarDecl : Decl {
     using VarType = TokenType;
@@ -129,6 +213,7 @@ struct VarDecl : Decl {
     std::string ident;
     std::string type;
     VarType var_type; // auto / extern
+    Slot slot;
 
     VarDecl( // std::shared_ptr<Expr> expr,
         std::string& ident, std::string& type, VarType var_type)
@@ -146,6 +231,8 @@ struct FunDecl : Decl {
     std::string type;
     std::vector<std::string> param_list;
     std::shared_ptr<CompStmt> comp_stmt;
+    std::size_t index { 0 }; // into Program::functions
+    std::size_t frame_size { 0 }; // locals, params take the first slots
 
     FunDecl(std::string& name, std::string type,
         std::vector<std::string> param_list,
@@ -158,9 +245,45 @@ struct FunDecl : Decl {
     }
 };
 
+// extern fun f64 pow(f64 x, f64 y); a function of a shared library, bound
+// when the program is loaded (native.hpp)
+struct NativeDecl : Decl {
+    std::string name;
+    std::string type;
+    std::vector<std::string> param_types;
+    std::size_t index { 0 }; // into Program::natives
+
+    NativeDecl(std::string& name, std::string type,
+        std::vector<std::string> param_types)
+        : name { std::move(name) }
+        , type { std::move(type) }
+        , param_types { std::move(param_types) }
+    {
+    }
+};
+
+struct Interface; // module.hpp
+
+// import name; makes the exports of another module visible through its
+// precompiled interface instead of its source
+struct ImportDecl : Decl {
+    std::string module;
+    std::shared_ptr<const Interface> interface; // loaded by Semantic
+
+    ImportDecl(std::string& module)
+        : module { std::move(module) }
+    {
+    }
+};
+
 struct Program {
     std::vector<std::shared_ptr<Decl>> decls;
 
+    // Module level tables, filled in by the Resolver
+    std::vector<std::shared_ptr<FunDecl>> functions;
+    std::vector<std::shared_ptr<VarDecl>> globals;
+    std::vector<std::shared_ptr<NativeDecl>> natives;
+
     Program(std::vector<std::shared_ptr<Decl>> decls)
         : decls { decls }
     {
@@ -180,52 +303,113 @@ struct IfStmt : Stmt {
         , else_branch { std::move(else_branch) }
     {
     }
+
+    StmtKind kind() const override { return StmtKind::IF; }
 };
 
 struct LoopStmt : Stmt {
     std::shared_ptr<Expr> cond;
     std::shared_ptr<Stmt> body;
+    bool rotated { false }; // cond tested after the body, see LoopOptimizer
 
     LoopStmt(std::shared_ptr<Expr> cond, std::shared_ptr<Stmt> body)
         : cond { std::move(cond) }
         , body { std::move(body) }
     {
     }
+
+    StmtKind kind() const override { return StmtKind::LOOP; }
+};
+
+struct Reduction {
+    Token op; // + or *
+    std::shared_ptr<Ident> var;
+};
+
+// loop parallel (i = lo, hi) reduce (+ s) body runs body for i = lo .. hi - 1
+// in any order, spread over threads (pool.hpp). Every thread works on its
+// own copy of the locals and accumulates each reduction variable from the
+// identity of its operator; the copies are combined after the loop. The body
+// may only write its own locals and the reduction variables (as s = s + e),
+// which Semantic checks. Functions it calls must not write globals or call
+// extern functions, see check_parallel_loops.
+struct ParLoopStmt : Stmt {
+    std::shared_ptr<Expr> init; // i = lo, an Assign
+    std::shared_ptr<Expr> end; // hi, evaluated once before the loop
+    std::vector<Reduction> reductions;
+    std::shared_ptr<Stmt> body;
+
+    ParLoopStmt(std::shared_ptr<Expr> init, std::shared_ptr<Expr> end,
+        std::vector<Reduction> reductions, std::shared_ptr<Stmt> body)
+        : init { std::move(init) }
+        , end { std::move(end) }
+        , reductions { std::move(reductions) }
+        , body { std::move(body) }
+    {
+    }
+
+    StmtKind kind() const override { return StmtKind::PARLOOP; }
 };
 
 struct FunCall : Expr {
     std::string name;
     std::vector<std::shared_ptr<Expr>> exprs;
+    Slot slot;
+    bool tail { false }; // operand of a return, see TailCalls
 
     FunCall(std::string& name, std::vector<std::shared_ptr<Expr>> exprs)
         : name { std::move(name) }
         , exprs { std::move(exprs) }
     {
     }
+
+    ExprKind kind() const override { return ExprKind::FUNCALL; }
 };
 
+// Recursive descent parser. Grammar rules dispatch through self() so a
+// derived pass (e.g. Semantic) can replace any rule at compile time without
+// paying for virtual calls; the defaults only check syntax.
+template <typename Derived>
 class Parser {
 protected:
     TokenStream tokens;
+    Diagnostics& diags;
+
+    Derived& self() { return static_cast<Derived&>(*this); }
+
+    // Errors unwind to the enclosing statement or declaration, get recorded
+    // in diags and parsing resumes after the sync point
+    [[noreturn]] void error(std::string msg);
+    // Checks the lexer's conversion, negated if the operand of a unary -
+    std::shared_ptr<Number> number(bool negated = false);
+    void sync_statement(std::size_t start);
+    void sync_declaration(std::size_t start);
 
 public:
-    virtual std::shared_ptr<Program> program();
-    virtual std::shared_ptr<Decl> declaration();
-    virtual std::vector<std::string> param_list();
-    virtual std::shared_ptr<CompStmt> compound() = 0;
-    virtual std::shared_ptr<Stmt> statement();
-    virtual std::shared_ptr<Expr> expression();
-    virtual std::shared_ptr<Expr> assign();
-    virtual std::shared_ptr<Expr> equality();
-    virtual std::shared_ptr<Expr> comparison();
-    virtual std::shared_ptr<Expr> term();
-    virtual std::shared_ptr<Expr> factor();
-    virtual std::shared_ptr<Expr> unary();
-    virtual std::shared_ptr<Expr> primary() = 0;
-    virtual std::shared_ptr<FunCall> funcall();
-    virtual std::vector<std::shared_ptr<Expr>> arg_list();
-
-    Parser(const TokenStream& tokens);
-    virtual ~Parser() = default;
+    std::shared_ptr<Program> program();
+    std::shared_ptr<Decl> declaration();
+    std::vector<std::string> param_list();
+    std::shared_ptr<CompStmt> compound();
+    std::shared_ptr<Stmt> statement();
+    std::shared_ptr<ParLoopStmt> par_loop();
+    std::shared_ptr<Stmt> par_body(const ParLoopStmt& loop, std::size_t pos);
+    std::shared_ptr<Expr> expression();
+    std::shared_ptr<Expr> assign();
+    std::shared_ptr<Expr> equality();
+    std::shared_ptr<Expr> comparison();
+    std::shared_ptr<Expr> term();
+    std::shared_ptr<Expr> factor();
+    std::shared_ptr<Expr> unary();
+    std::shared_ptr<Expr> primary();
+    std::shared_ptr<FunCall> funcall();
+    std::vector<std::shared_ptr<Expr>> arg_list();
+
+    Parser(TokenStream tokens, Diagnostics& diags);
     std::shared_ptr<Program> parse();
 };
+
+// Syntax-only instantiation: no symbol resolution, used by --syntax-only
+class SyntaxChecker : public Parser<SyntaxChecker> {
+public:
+    SyntaxChecker(TokenStream tokens, Diagnostics& diags);
+};
@@ -0,0 +1,154 @@
+#include "pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using std::lock_guard;
+using std::mutex;
+using std::size_t;
+using std::unique_lock;
+
+WorkPool::WorkPool(size_t threads)
+    : threads { threads != 0
+              ? threads
+              : std::max(1u, std::thread::hardware_concurrency()) }
+    , queues {}
+    , workers {}
+    , body { nullptr }
+    , generation { 0 }
+    , busy { 0 }
+    , stopping { false }
+    , failure { nullptr }
+{
+    for (size_t i = 0; i < this->threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        lock_guard<mutex> guard { lock };
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void WorkPool::run(int64_t begin, int64_t end, int64_t chunk, const Body& body)
+{
+    lock_guard<mutex> exclusive { running };
+    if (begin >= end)
+        return;
+
+    // Enough chunks per participant that the ones finishing early have
+    // something left to steal
+    uint64_t count { static_cast<uint64_t>(end)
+        - static_cast<uint64_t>(begin) };
+    uint64_t size { chunk > 0 ? static_cast<uint64_t>(chunk)
+                              : std::max<uint64_t>(1, count / (threads * 8)) };
+    uint64_t chunks { count / size + (count % size != 0) };
+    for (uint64_t k = 0; k < chunks; ++k) {
+        uint64_t first { static_cast<uint64_t>(begin) + k * size };
+        uint64_t last { k + 1 == chunks ? static_cast<uint64_t>(end)
+                                        : first + size };
+        queues[k * threads / chunks]->chunks.push_back(
+            { static_cast<int64_t>(first), static_cast<int64_t>(last) });
+    }
+
+    // Workers start on first use and then wait for the next generation
+    for (size_t self = workers.size() + 1; self < threads; ++self)
+        workers.emplace_back(&WorkPool::worker, this, self, generation);
+
+    {
+        lock_guard<mutex> guard { lock };
+        this->body = &body;
+        failure = nullptr;
+        busy = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::exception_ptr error { nullptr };
+    {
+        unique_lock<mutex> guard { lock };
+        done.wait(guard, [&] { return busy == 0; });
+        this->body = nullptr;
+        std::swap(error, failure);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void WorkPool::worker(size_t self, size_t seen)
+{
+    while (true) {
+        {
+            unique_lock<mutex> guard { lock };
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        work(self);
+
+        lock_guard<mutex> guard { lock };
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void WorkPool::work(size_t self)
+{
+    Chunk chunk {};
+    while (next(self, chunk)) {
+        try {
+            (*body)(self, chunk.begin, chunk.end);
+        } catch (...) {
+            {
+                lock_guard<mutex> guard { lock };
+                if (!failure)
+                    failure = std::current_exception();
+            }
+            for (auto& queue : queues) {
+                lock_guard<mutex> guard { queue->lock };
+                queue->chunks.clear();
+            }
+        }
+    }
+}
+
+// Own chunks from the back, stolen ones from the front. Nothing is added
+// while a run is going, so empty queues everywhere mean it is done.
+bool WorkPool::next(size_t self, Chunk& chunk)
+{
+    {
+        Queue& own { *queues[self] };
+        lock_guard<mutex> guard { own.lock };
+        if (!own.chunks.empty()) {
+            chunk = own.chunks.back();
+            own.chunks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < threads; ++i) {
+        Queue& victim { *queues[(self + i) % threads] };
+        lock_guard<mutex> guard { victim.lock };
+        if (!victim.chunks.empty()) {
+            chunk = victim.chunks.front();
+            victim.chunks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool for index ranges. A range is cut into chunks that are
+// dealt out to the participants in contiguous blocks; each participant works
+// through its own deque from the back and, once that is empty, steals from
+// the front of the others'. The thread calling run() takes part as
+// participant 0, so a pool of one thread never blocks.
+class WorkPool {
+public:
+    // Called with the participant and a chunk [begin, end)
+    using Body = std::function<void(std::size_t, int64_t, int64_t)>;
+
+private:
+    struct Chunk {
+        int64_t begin;
+        int64_t end;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Chunk> chunks;
+    };
+
+    std::size_t threads; // participants, the caller included
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers; // started by the first run()
+    std::mutex running; // one run() at a time
+
+    std::mutex lock; // guards everything below
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Body* body;
+    std::size_t generation; // bumped by every run()
+    std::size_t busy; // workers still on the current run
+    bool stopping;
+    std::exception_ptr failure; // the first exception thrown by body
+
+    void work(std::size_t self);
+    bool next(std::size_t self, Chunk& chunk);
+    void worker(std::size_t self, std::size_t seen);
+
+public:
+    // 0 threads means one per hardware thread
+    explicit WorkPool(std::size_t threads = 0);
+    ~WorkPool();
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    std::size_t size() const { return threads; }
+
+    // Runs body over [begin, end) in chunks of at most chunk indices (0
+    // picks one), returning once all of them are done. Rethrows the first
+    // exception of body, after which remaining chunks are dropped.
+    void run(int64_t begin, int64_t end, int64_t chunk, const Body& body);
+};
@@ -0,0 +1,124 @@
+#include "profile.hpp"
+#include "parser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+using std::size_t;
+using std::vector;
+
+CallStack::CallStack(size_t functions, size_t capacity)
+    : entries(capacity)
+    , depth { 0 }
+    , calls(functions, 0)
+{
+}
+
+Profiler::Profiler(const Program& program, CallStack& stack,
+    std::chrono::microseconds interval)
+    : program { program }
+    , stack { stack }
+    , interval { interval }
+    , running { false }
+    , sampler {}
+    , samples {}
+    , total { 0 }
+{
+}
+
+Profiler::~Profiler() { stop(); }
+
+void Profiler::start()
+{
+    running.store(true);
+    sampler = std::thread { [this] { sample_loop(); } };
+}
+
+void Profiler::stop()
+{
+    running.store(false);
+    if (sampler.joinable())
+        sampler.join();
+}
+
+void Profiler::sample_loop()
+{
+    vector<uint32_t> frames {};
+    auto next { std::chrono::steady_clock::now() };
+
+    while (running.load(std::memory_order_relaxed)) {
+        next += interval;
+        std::this_thread::sleep_until(next);
+
+        size_t depth { stack.depth.load(std::memory_order_acquire) };
+        if (depth == 0)
+            continue;
+
+        frames.resize(depth);
+        for (size_t i = 0; i < depth; ++i)
+            frames[i] = stack.entries[i].load(std::memory_order_relaxed);
+
+        ++samples[frames];
+        ++total;
+    }
+}
+
+void Profiler::write_folded(std::ostream& out) const
+{
+    for (const auto& [frames, count] : samples) {
+        for (size_t i = 0; i < frames.size(); ++i)
+            out << (i ? ";" : "") << program.functions[frames[i]]->name;
+        out << ' ' << count << '\n';
+    }
+}
+
+void Profiler::report(std::ostream& out) const
+{
+    size_t functions { program.functions.size() };
+    vector<size_t> self(functions, 0);
+    vector<size_t> inclusive(functions, 0);
+    vector<bool> seen(functions, false);
+
+    for (const auto& [frames, count] : samples) {
+        self[frames.back()] += count;
+
+        // Recursion counts once towards the total of a function
+        std::fill(seen.begin(), seen.end(), false);
+        for (uint32_t fun : frames) {
+            if (!seen[fun])
+                inclusive[fun] += count;
+            seen[fun] = true;
+        }
+    }
+
+    vector<size_t> order(functions);
+    for (size_t i = 0; i < functions; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+        [&](size_t a, size_t b) { return self[a] > self[b]; });
+
+    double ms { interval.count() / 1000.0 };
+    out << "PROFILE: " << total << " sample(s) every " << interval.count()
+        << " us\n"
+        << "PROFILE: " << std::left << std::setw(24) << "function"
+        << std::right << std::setw(12) << "calls" << std::setw(12)
+        << "self ms" << std::setw(12) << "total ms" << '\n';
+
+    for (size_t fun : order) {
+        if (stack.calls[fun] == 0)
+            continue;
+
+        out << "PROFILE: " << std::left << std::setw(24)
+            << program.functions[fun]->name << std::right << std::setw(12)
+            << stack.calls[fun] << std::fixed << std::setprecision(1)
+            << std::setw(12) << self[fun] * ms << std::setw(12)
+            << inclusive[fun] * ms << '\n';
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "parser.hpp"
+
+// Shadow copy of the interpreter's call stack (function indices) that a
+// sampler thread can read while the program runs. Only the interpreter
+// thread writes it; a sample taken mid update may be off by a frame.
+class CallStack {
+private:
+    std::vector<std::atomic<uint32_t>> entries;
+    std::atomic<std::size_t> depth;
+    std::vector<std::size_t> calls; // per function, read after the run
+
+    friend class Profiler;
+
+public:
+    CallStack(std::size_t functions, std::size_t capacity);
+
+    void push(std::size_t fun)
+    {
+        std::size_t top { depth.load(std::memory_order_relaxed) };
+        ++calls[fun];
+        if (top == entries.size())
+            return;
+        entries[top].store(static_cast<uint32_t>(fun), std::memory_order_relaxed);
+        depth.store(top + 1, std::memory_order_release);
+    }
+
+    void pop()
+    {
+        std::size_t top { depth.load(std::memory_order_relaxed) };
+        if (top > 0)
+            depth.store(top - 1, std::memory_order_release);
+    }
+};
+
+// Samples a CallStack from its own thread at a fixed interval and reports
+// folded stacks ("main;fib;fib 42", the input format of flamegraph.pl and
+// similar tools) plus self/total time and call counts per function.
+class Profiler {
+private:
+    const Program& program;
+    CallStack& stack;
+    std::chrono::microseconds interval;
+    std::atomic<bool> running;
+    std::thread sampler;
+    std::map<std::vector<uint32_t>, std::size_t> samples; // stack: count
+    std::size_t total;
+
+    void sample_loop();
+
+public:
+    Profiler(const Program& program, CallStack& stack,
+        std::chrono::microseconds interval);
+    ~Profiler();
+
+    void start();
+    void stop();
+    void write_folded(std::ostream& out) const;
+    void report(std::ostream& out) const;
+};
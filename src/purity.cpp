@@ -0,0 +1,134 @@
+#include "purity.hpp"
+#include "callgraph.hpp"
+#include "parser.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+// What the body does itself, calls to other functions aside. Reading
+// globals only counts against purity.
+static string local_effect(
+    const FunDecl& fun, const Program& program, bool reads)
+{
+    string reason {};
+    walk_stmt(fun.comp_stmt, [&](const shared_ptr<Expr>& expr) {
+        if (!reason.empty())
+            return;
+
+        if (auto assign = dynamic_pointer_cast<Assign>(expr);
+            assign != nullptr && assign->slot.kind == Slot::Kind::GLOBAL)
+            reason = "writes global " + assign->ident->name;
+        else if (auto ident = dynamic_pointer_cast<Ident>(expr); reads
+            && ident != nullptr && ident->slot.kind == Slot::Kind::GLOBAL)
+            reason = "reads global " + ident->name;
+        else if (auto call = dynamic_pointer_cast<FunCall>(expr);
+            call != nullptr && call->slot.kind == Slot::Kind::NATIVE)
+            reason = "calls extern function "
+                + program.natives[call->slot.index]->name;
+    });
+    return reason;
+}
+
+// Callees first, so only calls within a cycle are still open when a
+// function is looked at; a cycle is clean unless one of its members is not
+static void spread(const Program& program, const CallGraph& graph,
+    bool reads, vector<bool>& clean, vector<string>& reasons)
+{
+    for (const auto& component : graph.bottom_up()) {
+        string reason {};
+        for (size_t fun : component) {
+            reasons[fun]
+                = local_effect(*program.functions[fun], program, reads);
+            if (reason.empty() && !reasons[fun].empty())
+                reason = program.functions[fun]->name + " "
+                    + reasons[fun];
+
+            for (size_t callee : graph.calls(fun))
+                if (reason.empty()
+                    && std::find(component.begin(), component.end(), callee)
+                        == component.end()
+                    && !clean[callee])
+                    reason = "calls " + program.functions[callee]->name
+                        + ", which " + reasons[callee];
+        }
+
+        for (size_t fun : component) {
+            if (reasons[fun].empty())
+                reasons[fun] = reason;
+            clean[fun] = reason.empty();
+        }
+    }
+}
+
+Purity::Purity(const Program& program)
+    : pure_functions(program.functions.size(), false)
+    , reasons(program.functions.size())
+    , shared_functions(program.functions.size(), false)
+    , shared_reasons(program.functions.size())
+{
+    CallGraph graph { program };
+    spread(program, graph, true, pure_functions, reasons);
+    spread(program, graph, false, shared_functions, shared_reasons);
+}
+
+// Finds the parallel loops under stmt, including nested ones
+static void parallel_loops(
+    const shared_ptr<Stmt>& stmt, vector<const ParLoopStmt*>& loops)
+{
+    if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        for (const auto& inner : comp->stmts)
+            parallel_loops(inner, loops);
+    else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        parallel_loops(if_stmt->if_branch, loops);
+        parallel_loops(if_stmt->else_branch, loops);
+    } else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt);
+        loop != nullptr)
+        parallel_loops(loop->body, loops);
+    else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr) {
+        loops.push_back(loop.get());
+        parallel_loops(loop->body, loops);
+    }
+}
+
+void check_parallel_loops(const Program& program)
+{
+    std::unique_ptr<Purity> purity { nullptr }; // only if there are loops
+
+    for (const auto& fun : program.functions) {
+        vector<const ParLoopStmt*> loops {};
+        parallel_loops(fun->comp_stmt, loops);
+
+        for (const ParLoopStmt* loop : loops)
+            walk_stmt(loop->body, [&](const shared_ptr<Expr>& expr) {
+                auto call { dynamic_pointer_cast<FunCall>(expr) };
+                if (call == nullptr)
+                    return;
+
+                if (call->slot.kind == Slot::Kind::NATIVE)
+                    throw std::runtime_error("ERROR: A parallel loop in "
+                        + fun->name + " calls extern function " + call->name);
+                if (call->slot.kind != Slot::Kind::FUNCTION)
+                    return;
+
+                if (purity == nullptr)
+                    purity = std::make_unique<Purity>(program);
+                if (!purity->thread_safe(call->slot.index))
+                    throw std::runtime_error("ERROR: A parallel loop in "
+                        + fun->name + " calls " + call->name + ", which "
+                        + purity->thread_reason(call->slot.index));
+            });
+    }
+}
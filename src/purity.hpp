@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+
+// Which functions of a resolved Program compute their result from their
+// arguments alone: they neither read nor write globals, call no extern
+// functions and only call pure functions. Calling one twice with the same
+// arguments gives the same result (or the same runtime error).
+//
+// Separately, which functions leave shared state alone: they may read
+// globals but neither write them nor call extern functions, directly or
+// through their callees, so any number of threads can run them at once.
+class Purity {
+private:
+    std::vector<bool> pure_functions; // indexed like Program::functions
+    std::vector<std::string> reasons; // why not, for impure ones
+    std::vector<bool> shared_functions; // safe to run on many threads
+    std::vector<std::string> shared_reasons; // why not, for the others
+
+public:
+    Purity(const Program& program);
+
+    bool pure(std::size_t fun) const { return pure_functions[fun]; }
+    const std::string& reason(std::size_t fun) const { return reasons[fun]; }
+    bool thread_safe(std::size_t fun) const { return shared_functions[fun]; }
+    const std::string& thread_reason(std::size_t fun) const
+    {
+        return shared_reasons[fun];
+    }
+};
+
+// Throws runtime_error if the body of a parallel loop calls an extern
+// function or a function that is not thread_safe(). Semantic only sees
+// the assignments in the body itself; callees are known once resolved.
+void check_parallel_loops(const Program& program);
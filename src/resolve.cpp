@@ -0,0 +1,187 @@
+#include "resolve.hpp"
+#include "parser.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::dynamic_pointer_cast;
+using std::runtime_error;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+
+void Resolver::resolve(Program& program)
+{
+    this->program = &program;
+    module.clear();
+    program.functions.clear();
+    program.globals.clear();
+    program.natives.clear();
+
+    for (auto decl : program.decls) {
+        if (auto fun = dynamic_pointer_cast<FunDecl>(decl); fun != nullptr) {
+            fun->index = program.functions.size();
+            module[fun->name] = { Slot::Kind::FUNCTION, fun->index };
+            program.functions.push_back(fun);
+        } else if (auto var = dynamic_pointer_cast<VarDecl>(decl);
+            var != nullptr) {
+            var->slot = { Slot::Kind::GLOBAL, program.globals.size() };
+            module[var->ident] = var->slot;
+            program.globals.push_back(var);
+        } else if (auto native = dynamic_pointer_cast<NativeDecl>(decl);
+            native != nullptr) {
+            native->index = program.natives.size();
+            module[native->name] = { Slot::Kind::NATIVE, native->index };
+            program.natives.push_back(native);
+        }
+    }
+
+    for (auto fun : program.functions)
+        function(*fun);
+}
+
+Slot Resolver::lookup(const string& name) const
+{
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
+        if (auto search = it->find(name); search != it->end())
+            return search->second;
+
+    if (auto search = module.find(name); search != module.end())
+        return search->second;
+
+    throw runtime_error("ERROR: Could not resolve " + name);
+}
+
+void Resolver::function(FunDecl& fun)
+{
+    scopes.clear();
+    scopes.push_back(ScopeTable {});
+    next_slot = 0;
+
+    for (const auto& param : fun.param_list)
+        scopes.back()[param] = { Slot::Kind::LOCAL, next_slot++ };
+    frame_size = next_slot;
+
+    // The body shares the parameters' scope so it can redeclare them
+    block(*fun.comp_stmt, false);
+    fun.frame_size = frame_size;
+}
+
+void Resolver::block(CompStmt& comp_stmt, bool new_scope)
+{
+    size_t saved { next_slot };
+    if (new_scope)
+        scopes.push_back(ScopeTable {});
+
+    for (auto decl : comp_stmt.decls) {
+        auto var { dynamic_pointer_cast<VarDecl>(decl) };
+        if (var == nullptr)
+            continue;
+
+        if (var->var_type == TokenType::EXTERN) {
+            auto search { module.find(var->ident) };
+            if (search == module.end())
+                throw runtime_error("ERROR: Could not resolve " + var->ident);
+            var->slot = search->second;
+        } else if (auto search = scopes.back().find(var->ident);
+            !new_scope && search != scopes.back().end()
+            && search->second.kind == Slot::Kind::LOCAL) {
+            var->slot = search->second;
+        } else {
+            var->slot = { Slot::Kind::LOCAL, next_slot++ };
+            frame_size = std::max(frame_size, next_slot);
+        }
+        scopes.back()[var->ident] = var->slot;
+    }
+
+    for (auto stmt : comp_stmt.stmts)
+        statement(stmt);
+
+    if (new_scope) {
+        scopes.pop_back();
+        next_slot = saved;
+    }
+}
+
+void Resolver::statement(const shared_ptr<Stmt>& stmt)
+{
+    if (auto expr_stmt = dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        expression(expr_stmt->expr);
+
+    else if (auto ret = dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr)
+        expression(ret->expr);
+
+    else if (auto comp = dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        block(*comp, true);
+
+    else if (auto if_stmt = dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        expression(if_stmt->cond);
+        statement(if_stmt->if_branch);
+        statement(if_stmt->else_branch);
+    }
+
+    else if (auto loop = dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr) {
+        expression(loop->cond);
+        statement(loop->body);
+    }
+
+    else if (auto loop = dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr) {
+        expression(loop->init);
+        expression(loop->end);
+        for (const auto& reduction : loop->reductions)
+            expression(reduction.var);
+        statement(loop->body);
+    }
+}
+
+void Resolver::expression(const shared_ptr<Expr>& expr)
+{
+    if (auto ident = dynamic_pointer_cast<Ident>(expr); ident != nullptr)
+        ident->slot = lookup(ident->name);
+
+    else if (auto assign = dynamic_pointer_cast<Assign>(expr);
+        assign != nullptr) {
+        expression(assign->ident);
+        expression(assign->expr);
+        assign->slot = assign->ident->slot;
+    }
+
+    else if (auto unary = dynamic_pointer_cast<Unary>(expr); unary != nullptr)
+        expression(unary->expr);
+
+    else if (auto binary = dynamic_pointer_cast<Binary>(expr);
+        binary != nullptr) {
+        expression(binary->left);
+        expression(binary->right);
+    }
+
+    else if (auto group = dynamic_pointer_cast<Grouping>(expr); group != nullptr)
+        expression(group->expr);
+
+    else if (auto call = dynamic_pointer_cast<FunCall>(expr); call != nullptr) {
+        call->slot = lookup(call->name);
+        if (call->slot.kind != Slot::Kind::FUNCTION
+            && call->slot.kind != Slot::Kind::NATIVE)
+            throw runtime_error("ERROR: " + call->name + " is not a function");
+
+        // Native code reads exactly the arguments it declares
+        if (call->slot.kind == Slot::Kind::NATIVE) {
+            size_t params {
+                program->natives[call->slot.index]->param_types.size()
+            };
+            if (call->exprs.size() != params)
+                throw runtime_error("ERROR: " + call->name + " takes "
+                    + std::to_string(params) + " argument(s)");
+        }
+
+        for (auto arg : call->exprs)
+            expression(arg);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.hpp"
+
+// Lowers names to storage slots after Semantic has checked the program:
+// locals get a fixed index in their function's frame, globals and functions
+// an index into Program::globals / Program::functions. Blocks follow the
+// same scoping as Semantic and slots of a closed block are reused.
+// Passes that rewrite the tree afterwards keep the slots up to date.
+class Resolver {
+private:
+    using ScopeTable = std::unordered_map<std::string, Slot>;
+
+    const Program* program { nullptr }; // being resolved
+    ScopeTable module;
+    std::vector<ScopeTable> scopes; // of the current function
+    std::size_t next_slot;
+    std::size_t frame_size;
+
+    Slot lookup(const std::string& name) const;
+    void function(FunDecl& fun);
+    void block(CompStmt& comp_stmt, bool new_scope);
+    void statement(const std::shared_ptr<Stmt>& stmt);
+    void expression(const std::shared_ptr<Expr>& expr);
+
+public:
+    void resolve(Program& program);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. Each side only writes its own index, the indices sit on separate
+// cache lines so the two threads do not bounce one between them.
+template <typename T, std::size_t N>
+class SpscRing {
+private:
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    std::array<T, N> slots;
+    alignas(64) std::atomic<std::size_t> head { 0 }; // next to pop
+    alignas(64) std::atomic<std::size_t> tail { 0 }; // next to push
+
+public:
+    // Producer side, value is only moved from when there was room
+    bool push(T& value)
+    {
+        std::size_t at { tail.load(std::memory_order_relaxed) };
+        if (at - head.load(std::memory_order_acquire) == N)
+            return false;
+
+        slots[at & (N - 1)] = std::move(value);
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& value)
+    {
+        std::size_t at { head.load(std::memory_order_relaxed) };
+        if (at == tail.load(std::memory_order_acquire))
+            return false;
+
+        value = std::move(slots[at & (N - 1)]);
+        head.store(at + 1, std::memory_order_release);
+        return true;
+    }
+};
@@ -1,10 +1,17 @@
 #include "semantic.hpp"
+#include "diagnostics.hpp"
 #include "lexer.hpp"
+#include "module.hpp"
 #include "parser.hpp"
+#include "types.hpp"
 
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
 #include <memory>
 #include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -14,41 +21,94 @@
 using std::make_shared;
 using std::optional;
 using std::pair;
-using std::runtime_error;
+using std::size_t;
 using std::shared_ptr;
 using std::string;
 using std::vector;
 
-// class Semantic : public Parser {
-// private:
-//     using ScopeTable = unordered_map<string, Symbol>;
-
-//     vector<ScopeTable> symbol_table; // { name: { is_func, type } }
-
-// public:
 shared_ptr<Program> Semantic::program()
 {
-    auto prog { Parser::program() };
     symbol_table.push_back(ScopeTable {});
+    auto prog { Parser::program() };
+
+    // Calls may name functions declared further down (or the function itself)
+    for (const auto& [name, pos] : forward_calls) {
+        auto search { symbol_table[0].find(name) };
+        if (search == symbol_table[0].end())
+            diags.error(pos, "The identifier " + name + " has not been defined!");
+        else if (!search->second.is_fun)
+            diags.error(pos, "The identifier " + name + " is not a function!");
+    }
 
-    for (auto decl : prog->decls) {
-        if (shared_ptr<FunDecl> fun = std::dynamic_pointer_cast<FunDecl>(decl);
-            fun != nullptr)
+    return prog;
+}
 
-            symbol_table[0][fun->name] = Symbol { true, fun->type };
+// Every declaration goes into the innermost open scope
+shared_ptr<Decl> Semantic::declaration()
+{
+    size_t pos { tokens.cur().pos };
+    if (tokens.match(TokenType::FUN))
+        fun_type = tokens.peek(1).token_type == TokenType::BASE_TYPE
+            ? tokens.peek(1).token_str
+            : "i32";
+    auto decl { Parser::declaration() };
+
+    // Exports of an imported module become globals of this one
+    if (shared_ptr<ImportDecl> import
+        = std::dynamic_pointer_cast<ImportDecl>(decl);
+        import != nullptr) {
+        try {
+            if (modules != nullptr)
+                import->interface = modules->load(import->module);
+        } catch (const std::runtime_error& e) {
+            diags.error(pos, e.what());
+            return decl;
+        }
 
-        else if (shared_ptr<VarDecl> var
-            = std::dynamic_pointer_cast<VarDecl>(decl);
-            var != nullptr)
+        if (import->interface == nullptr) {
+            diags.error(pos, "Could not find the interface of module "
+                + import->module + " (" + import->module + ".ai)");
+            return decl;
+        }
 
-            symbol_table[0][var->ident] = Symbol { false, var->type };
+        for (const auto& fun : import->interface->functions)
+            symbol_table[0][fun.name] = Symbol { true, fun.type };
+        for (const auto& global : import->interface->globals)
+            symbol_table[0][global.name] = Symbol { false, global.type };
     }
 
-    return prog;
+    else if (shared_ptr<FunDecl> fun = std::dynamic_pointer_cast<FunDecl>(decl);
+        fun != nullptr)
+
+        (*symbol_table.rbegin())[fun->name] = Symbol { true, fun->type };
+
+    else if (shared_ptr<NativeDecl> native
+        = std::dynamic_pointer_cast<NativeDecl>(decl);
+        native != nullptr) {
+        // Program::natives only lists the top level ones
+        if (symbol_table.size() > 1)
+            diags.error(pos, "The extern function " + native->name
+                + " must be declared at the top level!");
+        (*symbol_table.rbegin())[native->name]
+            = Symbol { true, native->type, false, native->param_types };
+    }
+
+    else if (shared_ptr<VarDecl> var = std::dynamic_pointer_cast<VarDecl>(decl);
+        var != nullptr)
+
+        (*symbol_table.rbegin())[var->ident] = Symbol { false, var->type,
+            var->var_type == TokenType::EXTERN && symbol_table.size() > 1 };
+
+    return decl;
 }
 
-// TODO: Redefine completely compound() and primary() here are leave out a
-// virtual ... = 0
+// Parameters are visible in the function body, which may redeclare them with
+// a type: fun sum(a, b) { auto i32 a; ... }
+vector<string> Semantic::param_list()
+{
+    params = Parser::param_list();
+    return params;
+}
 
 // Blocks used fo example:
 // fun i32 sum(a, b)
@@ -61,20 +121,25 @@ shared_ptr<Program> Semantic::program()
 // if (a ~= b) { return a; }
 shared_ptr<CompStmt> Semantic::compound()
 {
-    tokens.expect(TokenType::LBRACE,
-        "Expected a '{' but got a " + tokens.cur().token_str + " instead!");
+    tokens.expect(TokenType::LBRACE, "a '{'");
     tokens.advance(1);
 
     // push a new stack entry for scope
     symbol_table.push_back(ScopeTable {});
 
+    for (const auto& param : params)
+        (*symbol_table.rbegin())[param] = Symbol { false, "i32" };
+    params.clear();
+
     vector<shared_ptr<Decl>> decls {};
     vector<shared_ptr<Stmt>> stmts {};
 
     while (true) {
-        if (tokens.match(TokenType::FEOF))
-            throw runtime_error("ERROR: Expected a '}' but got "
-                + tokens.peek(-1).token_str + " instead!");
+        if (tokens.match(TokenType::FEOF)) {
+            symbol_table.pop_back();
+            error("Expected a '}' but got " + tokens.peek(-1).token_str
+                + " instead!");
+        }
 
         if (tokens.match(TokenType::RBRACE)) {
             tokens.advance(1);
@@ -82,40 +147,266 @@ shared_ptr<CompStmt> Semantic::compound()
             break;
         }
 
-        if (tokens.match(TokenType::EXTERN) || tokens.match(TokenType::AUTO)
-            || tokens.match(TokenType::BASE_TYPE)) {
+        size_t start { tokens.position() };
+        try {
+            if (tokens.match(TokenType::EXTERN)
+                || tokens.match(TokenType::AUTO)
+                || tokens.match(TokenType::BASE_TYPE))
+                decls.push_back(declaration());
+            else
+                stmts.push_back(statement());
+        } catch (const CompileError& e) {
+            diags.error(e);
+            sync_statement(start);
+        }
+    }
+
+    return make_shared<CompStmt>(decls, stmts);
+}
+
+const Symbol* Semantic::lookup(const string& name) const
+{
+    for (auto it = symbol_table.rbegin(); it != symbol_table.rend(); ++it)
+        if (auto search = it->find(name); search != it->end())
+            return &search->second;
+    return nullptr;
+}
+
+// Index into symbol_table of the innermost scope declaring name, the size of
+// symbol_table if none does
+size_t Semantic::scope_of(const string& name) const
+{
+    for (size_t i = symbol_table.size(); i-- > 0;)
+        if (symbol_table[i].count(name) != 0)
+            return i;
+    return symbol_table.size();
+}
 
-            auto decl { declaration() };
+static bool returns(const shared_ptr<Stmt>& stmt)
+{
+    if (std::dynamic_pointer_cast<RetStmt>(stmt) != nullptr)
+        return true;
+
+    if (auto comp = std::dynamic_pointer_cast<CompStmt>(stmt); comp != nullptr)
+        return std::any_of(comp->stmts.begin(), comp->stmts.end(), returns);
+
+    if (auto if_stmt = std::dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr)
+        return returns(if_stmt->if_branch) || returns(if_stmt->else_branch);
 
-            if (shared_ptr<FunDecl> fun
-                = std::dynamic_pointer_cast<FunDecl>(decl);
-                fun != nullptr)
+    if (auto loop = std::dynamic_pointer_cast<LoopStmt>(stmt); loop != nullptr)
+        return returns(loop->body);
 
-                (*symbol_table.rbegin())[fun->name]
-                    = Symbol { true, fun->type };
+    if (auto loop = std::dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr)
+        return returns(loop->body);
 
-            else if (shared_ptr<VarDecl> var
-                = std::dynamic_pointer_cast<VarDecl>(decl);
-                var != nullptr)
+    return false;
+}
 
-                (*symbol_table.rbegin())[var->ident]
-                    = Symbol { false, var->type };
+// Every thread gets its own copy of the index and the reduction variables,
+// so they have to be locals of the function; what the body declares is
+// private to an iteration and anything else it must leave alone
+shared_ptr<Stmt> Semantic::par_body(const ParLoopStmt& loop, size_t pos)
+{
+    vector<string> names { std::static_pointer_cast<Assign>(loop.init)
+                               ->ident->name };
+    for (const auto& reduction : loop.reductions)
+        names.push_back(reduction.var->name);
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        const Symbol* sym { lookup(names[i]) };
+        if (sym != nullptr && (scope_of(names[i]) == 0 || sym->external))
+            diags.error(pos,
+                string { i ? "The reduction variable " : "The index " }
+                    + names[i] + " of a parallel loop must be a local variable!");
+        if (std::find(names.begin(), names.begin() + i, names[i])
+            != names.begin() + i)
+            diags.error(pos, "The variable " + names[i]
+                + " appears twice in the header of a parallel loop!");
+    }
 
+    parallel.push_back({ symbol_table.size(), loop.reductions,
+        vector<size_t>(loop.reductions.size(), 0) });
+    shared_ptr<Stmt> body { nullptr };
+    try {
+        body = statement();
+    } catch (const CompileError&) {
+        parallel.pop_back();
+        throw;
+    }
+    ParallelBody done { std::move(parallel.back()) };
+    parallel.pop_back();
+
+    for (size_t k = 0; k < done.reductions.size(); ++k) {
+        const string& name { done.reductions[k].var->name };
+        if (done.reads[k] != 0)
+            diags.error(pos, "The parallel loop reads its reduction variable "
+                + name + " outside of " + name + " = " + name + " "
+                + done.reductions[k].op.token_str + " ...!");
+    }
+
+    if (returns(body))
+        diags.error(pos, "A parallel loop body cannot return!");
+
+    return body;
+}
+
+// Inside a parallel loop, a variable from outside the body may only be
+// written as one of its reductions: s = s + e, where e does not read s
+void Semantic::parallel_write(const Assign& assign, size_t pos)
+{
+    const string& name { assign.ident->name };
+    const Symbol* sym { lookup(name) };
+    size_t scope { scope_of(name) };
+
+    for (auto& body : parallel) {
+        if (scope >= body.depth && (sym == nullptr || !sym->external))
+            continue;
+
+        auto found { std::find_if(body.reductions.begin(),
+            body.reductions.end(), [&](const Reduction& reduction) {
+                return reduction.var->name == name;
+            }) };
+        if (found == body.reductions.end() || sym->external) {
+            diags.error(pos,
+                "The parallel loop body writes the shared variable " + name
+                    + "!");
+            continue;
+        }
+
+        // s = c + s + r is fine too, the operator is associative and
+        // commutative
+        TokenType op { found->op.token_type };
+        auto operand = [&](auto& self, const shared_ptr<Expr>& expr) -> bool {
+            if (auto ident = std::dynamic_pointer_cast<Ident>(expr))
+                return ident->name == name;
+            if (auto group = std::dynamic_pointer_cast<Grouping>(expr))
+                return self(self, group->expr);
+            auto binary { std::dynamic_pointer_cast<Binary>(expr) };
+            return binary != nullptr && binary->op.token_type == op
+                && (self(self, binary->left) || self(self, binary->right));
+        };
+        auto update { std::dynamic_pointer_cast<Binary>(assign.expr) };
+        if (update == nullptr || !operand(operand, update)) {
+            diags.error(pos, "The reduction variable " + name
+                + " can only be updated as " + name + " = " + name + " "
+                + found->op.token_str + " ...!");
+            continue;
+        }
+
+        // The target and the operand are the reads that belong here
+        size_t& reads { body.reads[found - body.reductions.begin()] };
+        reads -= std::min<size_t>(reads, 2);
+    }
+}
+
+// Why a (possibly negated) literal does not fit type, nothing if it does or
+// expr is not a literal
+static optional<string> out_of_range(shared_ptr<Expr> expr, const string& type)
+{
+    bool negative { false };
+    while (true) {
+        if (auto group = std::dynamic_pointer_cast<Grouping>(expr);
+            group != nullptr)
+            expr = group->expr;
+        else if (auto unary = std::dynamic_pointer_cast<Unary>(expr);
+            unary != nullptr && unary->op.token_type == TokenType::SUB) {
+            negative = !negative;
+            expr = unary->expr;
         } else
-            stmts.push_back(statement());
+            break;
     }
 
-    return make_shared<CompStmt>(decls, stmts);
+    auto number { std::dynamic_pointer_cast<Number>(expr) };
+    auto width { type_widths.find(type) };
+    if (number == nullptr || width == type_widths.end())
+        return std::nullopt;
+
+    std::ostringstream literal {};
+    literal << (negative ? "-" : "");
+    if (number->floating)
+        literal << number->real;
+    else
+        literal << static_cast<uint64_t>(number->number);
+
+    const TypeWidth& bits { width->second };
+    if (bits.floating) {
+        if (bits.bits == 32 && number->floating
+            && std::fabs(number->real) > FLT_MAX)
+            return "The literal " + literal.str() + " does not fit in " + type;
+        return std::nullopt;
+    }
+
+    if (number->floating)
+        return "The literal " + literal.str() + " is not an integer but "
+            + type + " is";
+
+    uint64_t magnitude { static_cast<uint64_t>(number->number) };
+    uint64_t max { bits.is_signed
+            ? (uint64_t { 1 } << (bits.bits - 1)) - 1 + negative
+            : negative ? 0
+                       : UINT64_MAX >> (64 - bits.bits) };
+    if (magnitude > max)
+        return "The literal " + literal.str() + " does not fit in " + type;
+
+    return std::nullopt;
+}
+
+// Literals stored in a typed variable have to fit: auto u8 x; x = 300;
+shared_ptr<Expr> Semantic::assign()
+{
+    size_t pos { tokens.cur().pos };
+    auto expr { Parser::assign() };
+
+    if (auto assign = std::dynamic_pointer_cast<Assign>(expr);
+        assign != nullptr)
+        if (const Symbol* sym = lookup(assign->ident->name); sym != nullptr)
+            if (auto msg = out_of_range(assign->expr, sym->type))
+                diags.error(pos, *msg + "!");
+
+    if (auto assign = std::dynamic_pointer_cast<Assign>(expr);
+        assign != nullptr && !parallel.empty())
+        parallel_write(*assign, pos);
+
+    return expr;
+}
+
+// Returned literals have to fit the result type: fun u8 f() { return 300; }
+shared_ptr<Stmt> Semantic::statement()
+{
+    size_t pos { tokens.cur().pos };
+    auto stmt { Parser::statement() };
+
+    if (auto ret = std::dynamic_pointer_cast<RetStmt>(stmt); ret != nullptr)
+        if (auto msg = out_of_range(ret->expr, fun_type))
+            diags.error(pos, *msg + "!");
+
+    return stmt;
+}
+
+// Literal arguments of an extern fun are converted to its parameter types,
+// so they have to fit them too: abs(4294967295) with abs(i32 x)
+shared_ptr<FunCall> Semantic::funcall()
+{
+    size_t pos { tokens.cur().pos };
+    const Symbol* sym { lookup(tokens.cur().token_str) };
+    vector<string> types { sym != nullptr ? sym->param_types
+                                          : vector<string> {} };
+    auto call { Parser::funcall() };
+
+    for (size_t i = 0; i < call->exprs.size() && i < types.size(); ++i)
+        if (auto msg = out_of_range(call->exprs[i], types[i]))
+            diags.error(pos, *msg + "!");
+
+    return call;
 }
 
 shared_ptr<Expr> Semantic::primary()
 {
     // std::cout << tokens.cur().token_str << '\n';
-    if (tokens.match(TokenType::NUMBER)) {
-        Token tok { tokens.cur() };
-        tokens.advance(1);
-        return make_shared<Number>(tok);
-    }
+    if (tokens.match(TokenType::NUMBER))
+        return number();
 
     if (tokens.match(TokenType::STRING)) {
         Token tok { tokens.cur() };
@@ -126,7 +417,7 @@ shared_ptr<Expr> Semantic::primary()
     if (tokens.match(TokenType::LPAREN)) {
         tokens.advance(1);
         shared_ptr<Expr> expr { expression() };
-        tokens.expect(TokenType::RPAREN, "Expected a ')'");
+        tokens.expect(TokenType::RPAREN, "a ')'");
         tokens.advance(1);
         return make_shared<Grouping>(expr);
     }
@@ -145,28 +436,45 @@ shared_ptr<Expr> Semantic::primary()
             }
         }
 
-        if (!sym.has_value())
-            throw runtime_error("ERROR: The indentifier "
-                + tokens.cur().token_str + " has not been defined!");
-
         if (tokens.peek(1).token_type == TokenType::LPAREN) {
+            if (!sym.has_value()) {
+                forward_calls.push_back(
+                    { tokens.cur().token_str, tokens.cur().pos });
+                return funcall();
+            }
+
             if (!sym.value().second.is_fun)
-                throw runtime_error("ERROR: The indentifier "
-                    + tokens.cur().token_str + " is not a function!");
+                error("The identifier " + tokens.cur().token_str
+                    + " is not a function!");
 
             return funcall();
         }
 
+        if (!sym.has_value())
+            error("The identifier " + tokens.cur().token_str
+                + " has not been defined!");
+
         Token tok { tokens.cur() };
         tokens.advance(1);
+
+        // Partial per thread inside a parallel loop, see par_body
+        size_t scope { scope_of(tok.token_str) };
+        for (auto& body : parallel)
+            for (size_t k = 0; k < body.reductions.size(); ++k)
+                if (body.reductions[k].var->name == tok.token_str
+                    && scope < body.depth)
+                    ++body.reads[k];
+
         return make_shared<Ident>(tok.token_str);
     }
 
-    throw runtime_error("ERROR: Expected an expression but got "
-        + tokens.cur().token_str + " instead!");
+    error("Expected an expression but got " + tokens.cur().token_str
+        + " instead!");
 }
 
-Semantic::Semantic(const TokenStream& tokens)
-    : Parser { tokens }
+Semantic::Semantic(
+    TokenStream tokens, Diagnostics& diags, ModuleLoader* modules)
+    : Parser { std::move(tokens), diags }
+    , modules { modules }
 {
 }
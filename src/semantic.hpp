@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "lexer.hpp"
+#include "module.hpp"
+#include "parser.hpp"
+
+struct Symbol {
+    bool is_fun;
+    std::string type;
+    bool external { false }; // extern declaration of a global in a block
+    std::vector<std::string> param_types {}; // of an extern fun
+};
+
+// Parser instantiation that resolves identifiers against scoped symbol tables
+class Semantic : public Parser<Semantic> {
+private:
+    using ScopeTable = std::unordered_map<std::string, Symbol>;
+
+    std::vector<ScopeTable> symbol_table; // { name: { is_func, type } }
+    std::vector<std::string> params; // of the function being parsed
+    std::string fun_type; // result type of the function being parsed
+    std::vector<std::pair<std::string, std::size_t>> forward_calls;
+    ModuleLoader* modules; // resolves imports, none if nullptr
+
+    // Parallel loop bodies being parsed, innermost last
+    struct ParallelBody {
+        std::size_t depth; // scopes from this one on belong to the body
+        std::vector<Reduction> reductions;
+        std::vector<std::size_t> reads; // of each reduction variable
+    };
+    std::vector<ParallelBody> parallel;
+
+    const Symbol* lookup(const std::string& name) const;
+    std::size_t scope_of(const std::string& name) const;
+    void parallel_write(const Assign& assign, std::size_t pos);
+
+public:
+    std::shared_ptr<Program> program();
+    std::shared_ptr<Decl> declaration();
+    std::vector<std::string> param_list();
+    std::shared_ptr<CompStmt> compound();
+    std::shared_ptr<Stmt> statement();
+    std::shared_ptr<Stmt> par_body(const ParLoopStmt& loop, std::size_t pos);
+    std::shared_ptr<Expr> assign();
+    std::shared_ptr<Expr> primary();
+    std::shared_ptr<FunCall> funcall();
+
+    Semantic(TokenStream tokens, Diagnostics& diags,
+        ModuleLoader* modules = nullptr);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 static std::vector<std::string> base_types = {
@@ -20,3 +21,23 @@ static std::vector<std::string> base_types = {
     "f32", // single precision
     "f64", // double precision
 };
+
+// Storage of every base type, used to range check literals
+struct TypeWidth {
+    int bits;
+    bool is_signed;
+    bool floating;
+};
+
+static std::unordered_map<std::string, TypeWidth> type_widths = {
+    { "u8", { 8, false, false } },
+    { "u16", { 16, false, false } },
+    { "u32", { 32, false, false } },
+    { "u64", { 64, false, false } },
+    { "i8", { 8, true, false } },
+    { "i16", { 16, true, false } },
+    { "i32", { 32, true, false } },
+    { "i64", { 64, true, false } },
+    { "f32", { 32, true, true } },
+    { "f64", { 64, true, true } },
+};
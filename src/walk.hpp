@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+
+#include "parser.hpp"
+
+// Calls fn on every expression node under expr, parents before children
+template <typename F>
+void walk_expr(const std::shared_ptr<Expr>& expr, F&& fn)
+{
+    if (expr == nullptr)
+        return;
+
+    fn(expr);
+
+    if (auto assign = std::dynamic_pointer_cast<Assign>(expr);
+        assign != nullptr) {
+        walk_expr(assign->ident, fn);
+        walk_expr(assign->expr, fn);
+    } else if (auto unary = std::dynamic_pointer_cast<Unary>(expr);
+        unary != nullptr)
+        walk_expr(unary->expr, fn);
+    else if (auto binary = std::dynamic_pointer_cast<Binary>(expr);
+        binary != nullptr) {
+        walk_expr(binary->left, fn);
+        walk_expr(binary->right, fn);
+    } else if (auto group = std::dynamic_pointer_cast<Grouping>(expr);
+        group != nullptr)
+        walk_expr(group->expr, fn);
+    else if (auto call = std::dynamic_pointer_cast<FunCall>(expr);
+        call != nullptr)
+        for (const auto& arg : call->exprs)
+            walk_expr(arg, fn);
+}
+
+// Calls fn on every expression node in stmt and its nested statements
+template <typename F>
+void walk_stmt(const std::shared_ptr<Stmt>& stmt, F&& fn)
+{
+    if (stmt == nullptr)
+        return;
+
+    if (auto expr_stmt = std::dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        walk_expr(expr_stmt->expr, fn);
+    else if (auto ret = std::dynamic_pointer_cast<RetStmt>(stmt);
+        ret != nullptr)
+        walk_expr(ret->expr, fn);
+    else if (auto comp = std::dynamic_pointer_cast<CompStmt>(stmt);
+        comp != nullptr)
+        for (const auto& inner : comp->stmts)
+            walk_stmt(inner, fn);
+    else if (auto if_stmt = std::dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        walk_expr(if_stmt->cond, fn);
+        walk_stmt(if_stmt->if_branch, fn);
+        walk_stmt(if_stmt->else_branch, fn);
+    } else if (auto loop = std::dynamic_pointer_cast<LoopStmt>(stmt);
+        loop != nullptr) {
+        walk_expr(loop->cond, fn);
+        walk_stmt(loop->body, fn);
+    } else if (auto loop = std::dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr) {
+        walk_expr(loop->init, fn);
+        walk_expr(loop->end, fn);
+        for (const auto& reduction : loop->reductions)
+            walk_expr(reduction.var, fn);
+        walk_stmt(loop->body, fn);
+    }
+}
+
+// Calls fn with a reference to every top level expression in stmt and its
+// nested statements (conditions, statement expressions, returned values),
+// so a pass can replace them in place
+template <typename F>
+void walk_roots(std::shared_ptr<Stmt>& stmt, F&& fn)
+{
+    if (stmt == nullptr)
+        return;
+
+    if (auto expr_stmt = std::dynamic_pointer_cast<ExprStmt>(stmt);
+        expr_stmt != nullptr)
+        fn(expr_stmt->expr);
+    else if (auto ret = std::dynamic_pointer_cast<RetStmt>(stmt);
+        ret != nullptr)
+        fn(ret->expr);
+    else if (auto comp = std::dynamic_pointer_cast<CompStmt>(stmt);
+        comp != nullptr)
+        for (auto& inner : comp->stmts)
+            walk_roots(inner, fn);
+    else if (auto if_stmt = std::dynamic_pointer_cast<IfStmt>(stmt);
+        if_stmt != nullptr) {
+        fn(if_stmt->cond);
+        walk_roots(if_stmt->if_branch, fn);
+        walk_roots(if_stmt->else_branch, fn);
+    } else if (auto loop = std::dynamic_pointer_cast<LoopStmt>(stmt);
+        loop != nullptr) {
+        fn(loop->cond);
+        walk_roots(loop->body, fn);
+    } else if (auto loop = std::dynamic_pointer_cast<ParLoopStmt>(stmt);
+        loop != nullptr) {
+        fn(loop->init);
+        fn(loop->end);
+        walk_roots(loop->body, fn);
+    }
+}